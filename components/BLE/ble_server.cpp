@@ -202,10 +202,6 @@ esp_err_t BLEServer::addService(BLEService *service) {
 
 BLEService::BLEService(const std::string &service_name)
     : m_service_name{service_name}, is_device_connected{false} {
-  m_queue_handle = xQueueCreate(5, sizeof(uint8_t));
-  if (m_queue_handle == NULL) {
-    ESP_LOGE(FILE_TAG, "Queue creation failed!");
-  }
   m_profile = {};
 }
 
@@ -217,12 +213,13 @@ void BLEService::onRead(uint8_t value) {
 }
 
 void BLEService::onWrite(uint8_t value) {
-  if (xQueueSend(m_queue_handle, &value, 1 / portTICK_PERIOD_MS) != pdPASS) {
-    ESP_LOGE(FILE_TAG, "Failed to send the message\n");
+  if (!m_keys.push({value, key_clock_us()})) {
+    ESP_LOGE(FILE_TAG, "Key ring full, dropped %d (%u so far)\n", value,
+             static_cast<unsigned>(m_keys.dropped_count()));
   }
   ESP_LOGD(FILE_TAG, "On write executing! Received %d", value);
 }
-xQueueHandle BLEService::getQueueHandle() { return m_queue_handle; }
+key_event_ring *BLEService::getKeyRing() { return &m_keys; }
 
 // TODO:Later check if this var is really needed
 uint8_t BLEServer::adv_config_done = 0;
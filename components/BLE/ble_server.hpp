@@ -11,12 +11,13 @@ extern "C" {
 #include "esp_gatts_api.h"
 #include "esp_log.h"
 #include "esp_system.h"
-#include "freertos/queue.h"
 }
 #include <map>
 #include <string>
 #include <vector>
 
+#include "key_event.hpp"
+
 struct gatts_profile_inst {
   esp_gatts_cb_t gatts_cb;
   uint16_t gatts_if;
@@ -51,12 +52,13 @@ public:
   void gatts_profile_a_event_handler(esp_gatts_cb_event_t event,
                                      esp_gatt_if_t gatts_if,
                                      esp_ble_gatts_cb_param_t *param);
-  xQueueHandle getQueueHandle();
+  // Key presses written by the client, drained by the keyboard
+  key_event_ring *getKeyRing();
   bool isDeviceConnected();
 
 private:
   std::string m_service_name;
-  xQueueHandle m_queue_handle;
+  key_event_ring m_keys;
   gatts_profile_inst m_profile;
   bool is_device_connected;
   //   esp_gatt_char_prop_t m_char_prop;
@@ -0,0 +1,13 @@
+#ifndef AOT_ROMS_HPP_
+#define AOT_ROMS_HPP_
+
+#include <string_view>
+
+#include "aot.hpp"
+
+// Translations of the ROMs in externals/rom, generated at build time by
+// tools/chip8_aot.py. Looks a ROM up by its file name, e.g. "pong.ch8".
+// Returns nullptr for ROMs that were not translated.
+const aot_rom *find_aot_rom(std::string_view name);
+
+#endif // AOT_ROMS_HPP_
@@ -3,6 +3,7 @@ extern "C" {
 #include "esp_spiffs.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "sdkconfig.h"
 }
@@ -12,21 +13,35 @@ extern "C" {
 #include <string>
 #include <string_view>
 
+#include "aot_roms.hpp"
 #include "ble_server.hpp"
 #include "chip8.hpp"
 #include "cpu.hpp"
 #include "display.hpp"
 #include "keyboard.hpp"
+#include "triple_buffer.hpp"
 
 // static defines
 static constexpr const char *FILE_TAG = "CHIP8";
 static const std::vector<std::string_view> TEST_ROM = {
     "/test_opcode.ch8", "/pong.ch8", "/invaders.ch8", "/tetris.ch8"};
 static const int NR_OF_ROMS = TEST_ROM.size();
+static const TickType_t FRAME_PERIOD = pdMS_TO_TICKS(1000 / 60);
 enum class EMU_STATE { SELECT_OPTION, PLAY_GAME };
 
+// The emulator task hands finished frames to the render task through
+// frames and wakes it up. Whoever draws on the display holds
+// display_lock, so the menu never races a frame that is still going out.
+static frame_mailbox frames;
+static SemaphoreHandle_t display_lock;
+static TaskHandle_t render_task;
+// The game left last, resumed when it is picked again. Only used by the
+// emulator task.
+static saved_state suspended;
+static int suspended_rom = -1;
+
 // Setup BT, disp
-[[nodiscard]] static esp_err_t ble_setup(xQueueHandle &numpad) {
+[[nodiscard]] static esp_err_t ble_setup(key_event_ring *&numpad) {
   esp_err_t ret = ESP_OK;
   // I know this is a memory leak, but the lifetime of
   // the BLE server should last for the complete lifetime of BLE(bluedroid)
@@ -47,7 +62,7 @@ enum class EMU_STATE { SELECT_OPTION, PLAY_GAME };
     ESP_LOGE(FILE_TAG, "%s Service startup failed: %s\n", __func__,
              esp_err_to_name(ret));
   }
-  numpad = service_p->getQueueHandle();
+  numpad = service_p->getKeyRing();
   return ret;
 }
 [[nodiscard]] static esp_err_t setup_fs() {
@@ -92,40 +107,99 @@ static void get_option_selection(keyboard *numpad_handle, int &rom_selection) {
   TFTDisp::setPortrait();
 }
 
+// Draws the newest published frame whenever the emulator signals one,
+// on the core the emulator does not run on
+static void render(void * /*params*/) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    if (const display_frame *frame = frames.take()) {
+      TFTDisp::drawGfx(frame->rows, frame->damage);
+    }
+    xSemaphoreGive(display_lock);
+  }
+}
+
 static void start(void *params) {
-  xQueueHandle numpad_queue = params;
+  auto *numpad_ring = static_cast<key_event_ring *>(params);
   int rom_selection;
   EMU_STATE state = EMU_STATE::SELECT_OPTION;
 
   std::unique_ptr<ExitButton> exit_button = std::make_unique<ExitButton>();
-  std::unique_ptr<keyboard> numpad = std::make_unique<keyboard>(numpad_queue);
+  std::unique_ptr<keyboard> numpad = std::make_unique<keyboard>(numpad_ring);
   numpad->addExitButtonObserver(exit_button.get());
-  chip8 emulator{numpad.get()};
+  // The VM carries a decoded copy of guest memory, which is too big to
+  // live on this task's stack
+  std::unique_ptr<chip8> emulator = std::make_unique<chip8>(numpad.get());
 
+  xSemaphoreTake(display_lock, portMAX_DELAY);
   while (1) {
     switch (state) {
     case EMU_STATE::SELECT_OPTION: {
       TFTDisp::clearScreen();
       get_option_selection(numpad.get(), rom_selection);
-      std::string rom_file = CONFIG_SPIFFS_BASE_DIR;
-      rom_file += TEST_ROM[rom_selection];
-      emulator.load_memory(rom_file);
+      // Picking the game that was left last carries on where it stopped
+      const bool resume = (rom_selection == suspended_rom) &&
+                          emulator->load_state(suspended);
+      if (!resume) {
+        std::string rom_file = CONFIG_SPIFFS_BASE_DIR;
+        rom_file += TEST_ROM[rom_selection];
+        emulator->load_memory(rom_file);
+      }
+      // Run the build time translation of the ROM when there is one
+      const bool translated = emulator->attach_aot(
+          find_aot_rom(TEST_ROM[rom_selection].substr(1)));
+      emulator->set_dispatch_mode(translated ? dispatch_mode::aot
+                                             : dispatch_mode::fused);
       TFTDisp::clearScreen();
+      // The display belongs to the render task while the game runs
+      xSemaphoreGive(display_lock);
+      if (resume) {
+        frames.publish(emulator->get_display_rows(),
+                       emulator->take_display_damage());
+        xTaskNotifyGive(render_task);
+      }
       state = EMU_STATE::PLAY_GAME;
       break;
     }
     case EMU_STATE::PLAY_GAME: {
+      TickType_t last_frame = xTaskGetTickCount();
       while (!exit_button->isPressed()) {
-        emulator.step_one_cycle();
-        // To avoid drawing in every cycle
-        if (emulator.get_display_flag()) {
-          TFTDisp::drawGfx(emulator.get_display_pixels());
-        }
-        vTaskDelay(2 / portTICK_PERIOD_MS);
         numpad->storeKeyPress();
+        const auto frame = emulator->run_frame();
+        // To avoid drawing frames that did not change
+        if (frame.display_changed) {
+          frames.publish(emulator->get_display_rows(),
+                         emulator->take_display_damage());
+          xTaskNotifyGive(render_task);
+        }
+        vTaskDelayUntil(&last_frame, FRAME_PERIOD);
+      }
+      // Take the display back and throw away the frame the render task
+      // did not get to
+      xSemaphoreTake(display_lock, portMAX_DELAY);
+      static_cast<void>(frames.take());
+#ifdef CONFIG_CHIP8_PROFILER
+      // Where the game spent its time, for host/chip8_profile. Too big
+      // for the stack, and only ever used from this task.
+      static vm_profile profile;
+      emulator->get_profile(profile);
+      profile.dump(stdout);
+#endif
+#ifdef CONFIG_CHIP8_TRACE
+      // For tools/chip8_trace.py
+      std::FILE *trace = std::fopen(CONFIG_SPIFFS_BASE_DIR "/trace.bin", "wb");
+      if (!trace || !emulator->write_trace(trace)) {
+        ESP_LOGE(FILE_TAG, "Writing the instruction trace failed");
+      }
+      if (trace) {
+        std::fclose(trace);
       }
+#endif
       // flush the key input
       numpad->clearKeyInput();
+      emulator->save_state(suspended);
+      suspended_rom = rom_selection;
       state = EMU_STATE::SELECT_OPTION;
       break;
     }
@@ -137,7 +211,7 @@ static void start(void *params) {
 
 [[nodiscard]] esp_err_t CHIP8::run() {
   esp_err_t ret = ESP_OK;
-  xQueueHandle numpad;
+  key_event_ring *numpad = nullptr;
   ret = TFTDisp::init();
   if (ret) {
     ESP_LOGE(FILE_TAG, "TFT display init failed %s\n", esp_err_to_name(ret));
@@ -147,6 +221,9 @@ static void start(void *params) {
     ESP_LOGE(FILE_TAG, "%s BLE Setup failed", __func__);
   }
   ret = setup_fs();
+  display_lock = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(render, "RENDER", 4096, NULL,
+                          configMAX_PRIORITIES - 2, &render_task, 0);
   xTaskCreatePinnedToCore(start, "CHIP8", 20000, numpad,
                           configMAX_PRIORITIES - 1, NULL, 1);
   return ret;
@@ -1,12 +1,12 @@
 #include <algorithm>
-#include <bitset>
 #include <cstdlib>
 #include <sstream>
 #include <string>
-#include <utility>
 #include <map>
 
 extern "C" {
+#include "driver/gpio.h"
+#include "esp_attr.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "sdkconfig.h"
@@ -14,33 +14,74 @@ extern "C" {
 #include "tftspi.h"
 }
 #include "display.hpp"
+#include "line_renderer.hpp"
 
 // static defines
 static constexpr const char *FILE_TAG = "DISP";
 // TODO: Change all the static to be a part of class var
 static constexpr const spi_lobo_host_device_t SPI_BUS = TFT_HSPI_HOST;
 static constexpr int scale = 4;
-static std::bitset<display_size> disp_cache{0};
 
 static const std::map<std::string_view, std::string_view> rom2name{
     {"test_opcode.ch8" , "Test ROM"},
     {"pong.ch8" , "Pong"},
     {"invaders.ch8" , "Space Invaders"},
     {"tetris.ch8" , "Tetris"}};
+
 /*
-This function changes the reference axis based on the display midpoint in
-ILI9341 display which has a width of 240 pixels and height of 320 pixels The
-formula is as follows: x in new ref axis = (TFT_WIDTH/2) + scale/2 * 32 - 4*y y
-in new ref axis = (TFT_HEIGHT/2) - scale/2 * 32 + 4*x
+The CHIP8 screen is drawn turned by a quarter around the midpoint of the
+ILI9341, which has a width of 240 pixels and height of 320 pixels. Guest
+pixel (x, y) lands at x in new ref axis = (TFT_WIDTH/2) + scale/2 * 32 - 4*y,
+y in new ref axis = (TFT_HEIGHT/2) - scale/2 * 64 + 4*x
 */
-static std::pair<int, int> transpose_xy(const int x, const int y) {
-  const auto transposed_x =
-      (CONFIG_TFT_DISPLAY_WIDTH / 2) + ((scale / 2) * 32) - (4 * y);
-  const auto transposed_y =
-      (CONFIG_TFT_DISPLAY_HEIGHT / 2) - ((scale / 2) * 64) + (4 * x);
+static constexpr panel_geometry geometry{
+    scale, (CONFIG_TFT_DISPLAY_WIDTH / 2) + ((scale / 2) * 32),
+    (CONFIG_TFT_DISPLAY_HEIGHT / 2) - ((scale / 2) * 64),
+    panel_rotation::quarter_turn};
+
+// Sends a region to the panel: the address window once, then the pixels
+// straight out of the line buffer by DMA
+class tft_bus {
+public:
+  void set_window(const int x0, const int y0, const int x1, const int y1) {
+    uint8_t columns[] = {high(x0), low(x0), high(x1), low(x1)};
+    uint8_t pages[] = {high(y0), low(y0), high(y1), low(y1)};
+    disp_select();
+    disp_spi_transfer_cmd_data(TFT_CASET, columns, sizeof(columns));
+    disp_spi_transfer_cmd_data(TFT_PASET, pages, sizeof(pages));
+    disp_spi_transfer_cmd(TFT_RAMWR);
+    gpio_set_level(static_cast<gpio_num_t>(PIN_NUM_DC), 1);
+  }
+  void push(const void *data, const std::size_t bytes) {
+    spi_lobo_transaction_t transfer{};
+    transfer.length = bytes * 8;
+    transfer.tx_buffer = data;
+    const esp_err_t ret = spi_lobo_transfer_data(tft_disp_spi, &transfer);
+    if (ret != ESP_OK) {
+      ESP_LOGE(FILE_TAG, "SPI: pixel transfer failed %s",
+               esp_err_to_name(ret));
+    }
+  }
+  void end_window() { disp_deselect(); }
 
-  return {transposed_x, transposed_y};
-}
+private:
+  static uint8_t high(const int value) {
+    return static_cast<uint8_t>(value >> 8);
+  }
+  static uint8_t low(const int value) { return static_cast<uint8_t>(value); }
+};
+
+// Two guest lines at full scale, 4 KiB. It has to be in DMA capable
+// memory and stay below max_transfer_sz of the bus.
+static constexpr std::size_t line_buffer_pixels =
+    2 * display_x * scale * scale;
+static DMA_ATTR rgb565 line_buffer[line_buffer_pixels];
+static tft_bus bus;
+// Knows what is currently on the screen, only regions that differ get
+// redrawn
+static line_renderer<rgb565, tft_bus> renderer{
+    bus, geometry, line_buffer, line_buffer_pixels, make_rgb565(0, 255, 0),
+    make_rgb565(0, 0, 0)};
 
 [[nodiscard]] esp_err_t TFTDisp::init() {
   esp_err_t ret;
@@ -111,7 +152,10 @@ static std::pair<int, int> transpose_xy(const int x, const int y) {
 void TFTDisp::setLandscape() { TFT_setRotation(LANDSCAPE); }
 void TFTDisp::setPortrait() { TFT_setRotation(PORTRAIT); }
 
-void TFTDisp::clearScreen() { TFT_fillScreen(TFT_BLACK); }
+void TFTDisp::clearScreen() {
+  TFT_fillScreen(TFT_BLACK);
+  renderer.invalidate(display_rows{0});
+}
 void TFTDisp::drawCheck() {
   TFT_setRotation(LANDSCAPE);
   int y = 4;
@@ -125,18 +169,25 @@ void TFTDisp::drawCheck() {
 }
 
 void TFTDisp::drawGfx(const std::array<uint8_t, display_size> &gfx) {
+  display_rows rows{0};
   for (uint y = 0; y < display_y; ++y) {
     for (uint x = 0; x < display_x; ++x) {
-      const auto [new_x, new_y] = transpose_xy(x, y);
-      const auto index_distance = x + (display_x * y);
-      const color_t color = (gfx.at(index_distance) == 1) ? TFT_GREEN : tft_bg;
-      if ((gfx.at(index_distance) ^ disp_cache[index_distance])) {
-        disp_cache.set(index_distance, bool(gfx.at(index_distance)));
-        TFT_fillRect(new_x, new_y, 4, 4, color);
-        TFT_drawRect(new_x, new_y, 4, 4, color);
+      if (gfx.at(x + (display_x * y)) == 1) {
+        rows[y] |= uint64_t{1} << (display_x - 1 - x);
       }
     }
   }
+  drawGfx(rows);
+}
+
+void TFTDisp::drawGfx(const display_rows &rows) {
+  display_damage everything;
+  everything.add_all();
+  drawGfx(rows, everything);
+}
+
+void TFTDisp::drawGfx(const display_rows &rows, const display_damage &damage) {
+  renderer.draw(rows, damage);
 }
 
 // TODO: Make the rom list flexible by reading the file names from SPIFFS
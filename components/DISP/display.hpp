@@ -2,6 +2,7 @@
 #define DISPLAY_HPP_
 
 #include <array>
+#include <cstdint>
 #include <vector>
 #include <string_view>
 extern "C" {
@@ -12,6 +13,39 @@ extern "C" {
 static constexpr int display_x = 64;
 static constexpr int display_y = 32;
 static constexpr int display_size = display_x * display_y;
+// Packed framebuffer, one word per row. The most significant bit is the
+// leftmost pixel.
+using display_rows = std::array<uint64_t, display_y>;
+
+// Part of the framebuffer that may have changed since the last redraw:
+// a mask of rows plus the range of columns touched in any of them
+struct display_damage {
+  uint32_t rows{0}; // bit y set for row y
+  uint8_t first_column{display_x};
+  uint8_t last_column{0};
+
+  [[nodiscard]] bool empty() const { return rows == 0; }
+  void add(const uint32_t row_mask, const uint8_t first,
+           const uint8_t last) {
+    rows |= row_mask;
+    first_column = (first < first_column) ? first : first_column;
+    last_column = (last > last_column) ? last : last_column;
+  }
+  void add(const display_damage &other) {
+    if (!other.empty()) {
+      add(other.rows, other.first_column, other.last_column);
+    }
+  }
+  void add_all() { add(UINT32_MAX, 0, display_x - 1); }
+  // Columns first_column..last_column as a row mask
+  [[nodiscard]] uint64_t column_mask() const {
+    if (empty()) {
+      return 0;
+    }
+    const uint64_t from_first = UINT64_MAX >> first_column;
+    return from_first & ~((UINT64_MAX >> last_column) >> 1U);
+  }
+};
 
 namespace TFTDisp {
 [[nodiscard]] esp_err_t init();
@@ -19,6 +53,9 @@ void drawCheck();
 void displayOptions(const std::vector<std::string_view> &rom_list);
 void clearScreen();
 void drawGfx(const std::array<uint8_t, display_size> &gfx);
+void drawGfx(const display_rows &rows);
+// Only looks at the rows and columns in damage
+void drawGfx(const display_rows &rows, const display_damage &damage);
 void setLandscape();
 void setPortrait();
 } // namespace TFTDisp
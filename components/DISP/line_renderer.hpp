@@ -0,0 +1,200 @@
+#ifndef LINE_RENDERER_HPP_
+#define LINE_RENDERER_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "display.hpp"
+
+// Draws the CHIP8 framebuffer on a panel by expanding every changed region
+// into scaled pixels in a line buffer and streaming it behind a single
+// address window. The bus decides what that means on the wire:
+//
+//   void set_window(int x0, int y0, int x1, int y1); // inclusive corners
+//   void push(const void *data, std::size_t bytes);  // pixel data
+//   void end_window();                               // region done
+//
+// Pixel is whatever the panel expects on the wire, e.g. rgb565.
+
+// RGB565 in the byte order the ILI9341 expects, most significant byte first
+struct rgb565 {
+  uint8_t high;
+  uint8_t low;
+};
+
+static constexpr rgb565 make_rgb565(const uint8_t r, const uint8_t g,
+                                    const uint8_t b) noexcept {
+  const auto value = static_cast<uint16_t>(((r & 0xF8U) << 8) |
+                                           ((g & 0xFCU) << 3) | (b >> 3));
+  return {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+}
+
+enum class panel_rotation : uint8_t {
+  none,        // guest x runs along panel x
+  quarter_turn // guest x runs along panel y, guest y along -x
+};
+
+// Where guest pixel (0, 0) lands and how big a guest pixel is. With
+// quarter_turn, guest pixel (x, y) covers the scale x scale square at
+// (origin_x - scale * y, origin_y + scale * x).
+struct panel_geometry {
+  int scale;
+  int origin_x;
+  int origin_y;
+  panel_rotation rotation;
+};
+
+template <typename Pixel, typename Bus> class line_renderer {
+public:
+  // buffer must hold at least one guest line at full scale, i.e.
+  // 64 * scale * scale pixels
+  line_renderer(Bus &bus, const panel_geometry &geometry, Pixel *buffer,
+                const std::size_t buffer_pixels, const Pixel on,
+                const Pixel off)
+      : bus{bus}, geometry{geometry}, buffer{buffer},
+        buffer_pixels{buffer_pixels}, on{on}, off{off} {}
+
+  // Bring the panel up to date with rows. Only rows in damage are looked
+  // at, and of those only the ones that differ from what was drawn last.
+  // Every run of adjacent changed rows is split into regions at gaps of
+  // unchanged columns wider than split_gap, each region trimmed to the
+  // rows that changed in it.
+  void draw(const display_rows &rows, const display_damage &damage) {
+    const uint64_t columns = damage.column_mask();
+    display_rows diff{0};
+    uint32_t changed = 0;
+    for (uint32_t dirty = damage.rows; dirty != 0; dirty &= dirty - 1U) {
+      const auto y = static_cast<uint8_t>(__builtin_ctz(dirty));
+      diff[y] = (rows[y] ^ shown[y]) & columns;
+      if (diff[y] != 0) {
+        changed |= uint32_t{1} << y;
+        shown[y] = rows[y];
+      }
+    }
+    while (changed != 0) {
+      const auto first_row = static_cast<uint8_t>(__builtin_ctz(changed));
+      const uint32_t above = ~(changed >> first_row);
+      const auto count = static_cast<uint8_t>(
+          (above != 0) ? __builtin_ctz(above) : display_y - first_row);
+      const auto last_row = static_cast<uint8_t>(first_row + count - 1);
+      changed &= ~(((count == display_y) ? UINT32_MAX
+                                         : ((uint32_t{1} << count) - 1U))
+                   << first_row);
+
+      uint64_t remaining = 0;
+      for (uint8_t y = first_row; y <= last_row; y++) {
+        remaining |= diff[y];
+      }
+      while (remaining != 0) {
+        const auto first_column =
+            static_cast<uint8_t>(__builtin_clzll(remaining));
+        auto last_column = first_column;
+        for (uint64_t after = following(remaining, last_column);
+             (after != 0) &&
+             ((__builtin_clzll(after) - last_column) <= split_gap);
+             after = following(remaining, last_column)) {
+          last_column = static_cast<uint8_t>(__builtin_clzll(after));
+        }
+        remaining = following(remaining, last_column);
+
+        const uint64_t span = (UINT64_MAX >> first_column) &
+                              ~following(UINT64_MAX, last_column);
+        uint8_t top = first_row;
+        while ((diff[top] & span) == 0) {
+          top++;
+        }
+        uint8_t bottom = last_row;
+        while ((diff[bottom] & span) == 0) {
+          bottom--;
+        }
+        draw_region(rows, top, bottom, first_column, last_column);
+      }
+    }
+  }
+
+  // Forget what is on the panel, e.g. after it was cleared behind our back
+  void invalidate(const display_rows &on_panel) { shown = on_panel; }
+
+private:
+  // Streaming this many unchanged columns costs about as much as setting
+  // up another address window
+  static constexpr int split_gap = 8;
+
+  Bus &bus;
+  const panel_geometry geometry;
+  Pixel *const buffer;
+  const std::size_t buffer_pixels;
+  const Pixel on;
+  const Pixel off;
+  // What the panel currently shows
+  display_rows shown{0};
+
+  // Bits of mask to the right of column
+  static uint64_t following(const uint64_t mask, const uint8_t column) {
+    return (column == display_x - 1) ? 0 : mask & (UINT64_MAX >> (column + 1));
+  }
+
+  static bool pixel(const display_rows &rows, const uint8_t x,
+                    const uint8_t y) {
+    return ((rows[y] >> (display_x - 1 - x)) & 1U) != 0;
+  }
+
+  // Guest pixels [first_column, last_column] x [first_row, last_row]
+  void draw_region(const display_rows &rows, const uint8_t first_row,
+                   const uint8_t last_row, const uint8_t first_column,
+                   const uint8_t last_column) {
+    const int scale = geometry.scale;
+    const bool turned = geometry.rotation == panel_rotation::quarter_turn;
+    // A panel line walks guest pixels across, lines advance down
+    const int across = turned ? (last_row - first_row + 1)
+                              : (last_column - first_column + 1);
+    const int down = turned ? (last_column - first_column + 1)
+                            : (last_row - first_row + 1);
+    const auto width = static_cast<std::size_t>(across * scale);
+    if (turned) {
+      const int x0 = geometry.origin_x - (scale * last_row);
+      const int y0 = geometry.origin_y + (scale * first_column);
+      bus.set_window(x0, y0, x0 + static_cast<int>(width) - 1,
+                     y0 + (down * scale) - 1);
+    } else {
+      const int x0 = geometry.origin_x + (scale * first_column);
+      const int y0 = geometry.origin_y + (scale * first_row);
+      bus.set_window(x0, y0, x0 + static_cast<int>(width) - 1,
+                     y0 + (down * scale) - 1);
+    }
+
+    std::size_t used = 0;
+    for (int line = 0; line < down; line++) {
+      if (used + (width * scale) > buffer_pixels) {
+        flush(used);
+      }
+      // Expand one guest line, then repeat it for the remaining scale lines
+      Pixel *out = buffer + used;
+      for (int i = 0; i < across; i++) {
+        const bool set =
+            turned ? pixel(rows, static_cast<uint8_t>(first_column + line),
+                           static_cast<uint8_t>(last_row - i))
+                   : pixel(rows, static_cast<uint8_t>(first_column + i),
+                           static_cast<uint8_t>(first_row + line));
+        out = std::fill_n(out, scale, set ? on : off);
+      }
+      used += width;
+      for (int copy = 1; copy < scale; copy++) {
+        std::copy_n(buffer + used - width, width, buffer + used);
+        used += width;
+      }
+    }
+    flush(used);
+    bus.end_window();
+  }
+
+  void flush(std::size_t &used) {
+    if (used != 0) {
+      bus.push(buffer, used * sizeof(Pixel));
+      used = 0;
+    }
+  }
+};
+
+#endif // LINE_RENDERER_HPP_
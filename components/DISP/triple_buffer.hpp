@@ -0,0 +1,99 @@
+#ifndef TRIPLE_BUFFER_HPP_
+#define TRIPLE_BUFFER_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "display.hpp"
+
+// Lock-free single producer, single consumer triple buffer. The producer
+// fills back() and publishes it; the consumer always gets the newest
+// published value and anything older that it never picked up is dropped.
+// Neither side ever waits for the other.
+//
+// Three slots take turns as back (owned by the producer), middle (the
+// last published one) and front (owned by the consumer). Publishing and
+// taking each swap one private slot with the middle, whose index lives
+// in a single atomic together with a flag that says whether it holds a
+// value the consumer has not seen yet.
+template <typename T> class triple_buffer {
+public:
+  // Producer side
+  T &back() { return slots[back_index]; }
+  // Returns false when the previously published value was never taken
+  bool publish() {
+    const uint8_t previous =
+        middle.exchange(back_index | fresh, std::memory_order_acq_rel);
+    back_index = previous & index_mask;
+    return (previous & fresh) == 0;
+  }
+  // Whether the consumer has picked up everything published so far
+  [[nodiscard]] bool taken() const {
+    return (middle.load(std::memory_order_acquire) & fresh) == 0;
+  }
+
+  // Consumer side. Moves the newest published value to front(), returns
+  // false if nothing was published since the last call.
+  bool take() {
+    if ((middle.load(std::memory_order_relaxed) & fresh) == 0) {
+      return false;
+    }
+    front_index =
+        middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+    return true;
+  }
+  const T &front() const { return slots[front_index]; }
+
+private:
+  static constexpr uint8_t index_mask = 0x3;
+  static constexpr uint8_t fresh = 0x4;
+
+  std::array<T, 3> slots{};
+  uint8_t back_index{0};
+  std::atomic<uint8_t> middle{1};
+  uint8_t front_index{2};
+};
+
+// A framebuffer on its way from the emulator to the renderer, together
+// with everything that may have changed since the renderer last saw one
+struct display_frame {
+  display_rows rows;
+  display_damage damage;
+};
+
+// triple_buffer of display_frames that never loses damage. When the
+// renderer skips frames, the damage of the skipped ones is carried into
+// the next frame it takes.
+class frame_mailbox {
+public:
+  // Producer side
+  void publish(const display_rows &rows, const display_damage &damage) {
+    // Once the renderer took the last frame, it has everything up to it
+    if (frames.taken()) {
+      pending = display_damage{};
+    }
+    pending.add(damage);
+    frames.back() = {rows, pending};
+    ++published;
+    if (!frames.publish()) {
+      ++dropped;
+    }
+  }
+  [[nodiscard]] uint32_t published_count() const { return published; }
+  [[nodiscard]] uint32_t dropped_count() const { return dropped; }
+
+  // Consumer side: the newest frame since the last call, or nullptr
+  const display_frame *take() {
+    return frames.take() ? &frames.front() : nullptr;
+  }
+
+private:
+  triple_buffer<display_frame> frames;
+  // Damage since the last frame the renderer is known to have taken
+  display_damage pending;
+  uint32_t published{0};
+  uint32_t dropped{0};
+};
+
+#endif // TRIPLE_BUFFER_HPP_
@@ -0,0 +1,59 @@
+#ifndef AOT_HPP_
+#define AOT_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu.hpp"
+
+// Runtime side of the ahead-of-time translated ROMs. tools/chip8_aot.py
+// turns every basic block of a ROM into a C++ function at build time,
+// chip8::attach_aot() hands the result to a VM and dispatch_mode::aot
+// runs it.
+
+// A block function runs the whole block, leaves the program counter at the
+// next instruction and returns the index of the block starting there, or
+// aot_dynamic_exit when that is only known at runtime (RET, BNNN).
+using aot_block_fn = uint16_t (*)(chip8 &vm);
+static constexpr uint16_t aot_dynamic_exit = 0xFFFF;
+
+struct aot_block {
+  uint16_t start;  // address of the first instruction
+  uint16_t end;    // one past the last byte of the block
+  uint16_t length; // number of guest instructions, all of which always run
+  aot_block_fn fn;
+};
+
+struct aot_rom {
+  const char *name;
+  const uint8_t *image; // the ROM the blocks were translated from
+  std::size_t image_size;
+  const aot_block *blocks; // sorted by start address
+  std::size_t block_count;
+};
+
+// The only door the generated code has into the VM
+class aot_runtime {
+public:
+  static std::array<uint8_t, 16> &V(chip8 &vm) { return vm.V; }
+  static uint16_t &I(chip8 &vm) { return vm.I; }
+  static uint8_t &delay_timer(chip8 &vm) { return vm.delay_timer; }
+  static uint8_t &sound_timer(chip8 &vm) { return vm.sound_timer; }
+  // Account for count executed instructions in the timers
+  static void ticks(chip8 &vm, const uint32_t count) {
+    vm.tick_timers(count);
+  }
+  static uint16_t pc(const chip8 &vm) { return vm.prog_counter; }
+  static void jump(chip8 &vm, const uint16_t target) {
+    vm.prog_counter = target;
+  }
+  // Run an instruction that is not translated inline through the
+  // interpreter handlers
+  static void exec(chip8 &vm, const uint16_t opcode, const uint16_t next_pc) {
+    vm.prog_counter = next_pc;
+    vm.execute_opcode(opcode);
+  }
+};
+
+#endif // AOT_HPP_
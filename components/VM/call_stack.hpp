@@ -0,0 +1,57 @@
+#ifndef CALL_STACK_HPP_
+#define CALL_STACK_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// The return addresses of 2NNN. The original interpreters had room for 16
+// of them, and so does this one, in place: pushing and popping never
+// touch the heap. Both report whether they could do their job.
+class call_stack {
+public:
+  static constexpr std::size_t capacity = 16;
+
+  [[nodiscard]] bool push(const uint16_t address) {
+    if (depth == capacity) {
+      return false;
+    }
+    addresses[depth++] = address;
+    return true;
+  }
+  [[nodiscard]] bool pop(uint16_t &address) {
+    if (depth == 0) {
+      return false;
+    }
+    address = addresses[--depth];
+    return true;
+  }
+  void clear() { depth = 0; }
+
+  [[nodiscard]] std::size_t size() const { return depth; }
+  [[nodiscard]] bool empty() const { return depth == 0; }
+  // Oldest first
+  [[nodiscard]] const uint16_t *begin() const { return addresses.data(); }
+  [[nodiscard]] const uint16_t *end() const {
+    return addresses.data() + depth;
+  }
+
+  bool operator==(const call_stack &other) const {
+    if (depth != other.depth) {
+      return false;
+    }
+    for (std::size_t i = 0; i < depth; ++i) {
+      if (addresses[i] != other.addresses[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!=(const call_stack &other) const { return !(*this == other); }
+
+private:
+  std::array<uint16_t, capacity> addresses{};
+  std::size_t depth{0};
+};
+
+#endif // CALL_STACK_HPP_
@@ -1,11 +1,15 @@
 extern "C" {
 #include "esp_log.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
 }
 #include <algorithm>
 #include <fstream>
-#include <random>
+#include <utility>
 
+#include "aot.hpp"
 #include "cpu.hpp"
+#include "handlers.hpp"
 #include "keyboard.hpp"
 
 struct BCD_t {
@@ -17,47 +21,6 @@ struct BCD_t {
 // static defines
 static constexpr const char *FILE_TAG = "CPU";
 
-// Mask function to get the first Nibble 0xN000
-// example: input is 0x6133, output will be 0x6000
-static constexpr uint16_t first_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0xF000U);
-}
-
-// Mask function to get the second Nibble 0x0N00
-// example: input is 0x6133, output will be 0x0100
-static constexpr uint16_t second_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x0F00U);
-}
-
-// Mask function to get the third Nibble 0x00N0
-// example: input is 0x6133, output will be 0x0030
-static constexpr uint8_t third_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x00F0U);
-}
-
-// Mask function to get the last Nibble 0x000N
-// example: input is 0x6133, output will be 0x0003
-static constexpr uint8_t last_nibble(const uint16_t opcode) noexcept {
-  return (opcode & 0x000FU);
-}
-// Mask function to get the last two nibbles 0x00NN
-// example: input is 0x6133, output will be 0x0033
-static constexpr uint8_t last_two_nibbles(const uint16_t opcode) noexcept {
-  return (opcode & 0x00FFU);
-}
-
-// Mask function to get the last three nibbles 0x0NNN
-// example: input is 0x6133, output will be 0x0133
-static constexpr uint16_t last_three_nibbles(const uint16_t opcode) noexcept {
-  return (opcode & 0x0FFFU);
-}
-// Mask function to get the last two nibbles 0x00NN
-// example: input is 0x6133, output will be 0x0100
-static constexpr std::pair<uint8_t, uint8_t>
-get_XY_nibbles(const uint16_t opcode) noexcept {
-  return {(second_nibble(opcode) >> 8), (third_nibble(opcode) >> 4)};
-}
-
 static constexpr BCD_t parse_BCD(const uint8_t number) {
 
   BCD_t BCD{0, 0, 0};
@@ -87,8 +50,10 @@ static constexpr std::array<uint8_t, 80> chip8_fonts = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-chip8::chip8() {
+chip8::chip8() : cycles_per_frame{CONFIG_CHIP8_CYCLES_PER_FRAME} {
   std::copy_n(chip8_fonts.begin(), chip8_fonts.size(), memory.begin());
+  predecode_memory();
+  seed_rng();
 }
 
 // chip8::chip8(std::unique_ptr<keyboard> keyPtr) : chip8{} {
@@ -97,85 +62,753 @@ chip8::chip8() {
 
 chip8::chip8(keyboard *keyPtr) : chip8{} { numpad = keyPtr; }
 
+// Defined here so that std::unique_ptr sees the complete jit type
+chip8::~chip8() = default;
+
 void chip8::load_memory(const std::vector<uint8_t> &rom_opcodes) {
   std::copy_n(rom_opcodes.begin(), rom_opcodes.size(),
               memory.begin() + prog_mem_begin);
+  aot = nullptr;
+  predecode_memory();
+  seed_rng();
+}
+
+void chip8::seed_rng() { rng.seed(fixed_seed ? *fixed_seed : esp_random()); }
+
+void chip8::set_fixed_seed(const uint32_t seed) {
+  fixed_seed = seed;
+  seed_rng();
+}
+
+void chip8::clear_fixed_seed() {
+  fixed_seed.reset();
+  seed_rng();
 }
 
 void chip8::reset_internal_states() {
   std::fill((memory.begin() + prog_mem_begin), memory.end(), 0);
   std::fill_n(V.begin(), V.size(), 0);
-  std::fill_n(display.begin(), display.size(), 0);
+  display.fill(0);
+  damage.add_all();
 
-  // Clear the stack
-  std::stack<uint16_t> tmp_hw_stack;
-  hw_stack.swap(tmp_hw_stack);
+  hw_stack.clear();
+  faults = {0, 0};
 
   I = 0;
   prog_counter = prog_mem_begin;
   delay_timer = 0;
   sound_timer = 0;
+  timer_phase = 0;
   isKeyBPressed = false;
   isDisplaySet = false;
+  reset_profile();
+  clear_trace();
+  clear_rewind();
+  seed_rng();
+}
+
+void chip8::reset() {
+  reset_internal_states();
+  stop_request = run_stop::budget;
+  aot = nullptr;
+  predecode_memory();
 }
 
 void chip8::load_memory(std::string_view file_name) {
   reset_internal_states();
   std::ifstream file;
-  std::vector<char> rom;
-  file.open(file_name.data(), std::ios::binary | std::ios::ate);
-
-  if (file.is_open()) {
-    std::streampos size = file.tellg();
-    rom.resize(static_cast<std::size_t>(size));
-    file.seekg(0, std::ios::beg);
-    file.read(rom.data(), size);
-    file.close();
-  } else {
+  file.open(file_name.data(), std::ios::binary);
+
+  if (!file.is_open()) {
     ESP_LOGE(FILE_TAG, "Given filename %s does not exist!", file_name.data());
     abort();
   }
-  std::copy_n(rom.begin(), rom.size(), memory.begin() + prog_mem_begin);
+  // Straight into guest memory, without a temporary copy on the heap
+  file.read(reinterpret_cast<char *>(memory.data() + prog_mem_begin),
+            static_cast<std::streamsize>(memory.size() - prog_mem_begin));
+  file.close();
+  aot = nullptr;
+  predecode_memory();
+}
+
+void chip8::predecode_memory() {
+  for (std::size_t i = 0; i < decoded_cache.size(); ++i) {
+    decoded_cache[i] = decode(
+        static_cast<uint16_t>((memory[2 * i] << 8) | memory[(2 * i) + 1]));
+  }
+  fuse_decoded(0, decoded_cache.size() - 1);
+#ifdef CHIP8_HAS_JIT
+  if (jit) {
+    jit->invalidate_all();
+  }
+#endif
+}
+
+// Mark decoded_cache entries first to last that start a superinstruction
+// together with the entry after them
+void chip8::fuse_decoded(const std::size_t first, const std::size_t last) {
+  for (std::size_t i = first; i <= last; ++i) {
+    decoded_cache[i].fused =
+        ((i + 1) < decoded_cache.size())
+            ? fuse(decoded_cache[i].id, decoded_cache[i + 1].id)
+            : fused_id::none;
+  }
+}
+
+// Called after the guest stored length bytes at address (FX33 and FX55
+// are the only opcodes writing memory). Re-decodes every cached
+// instruction that overlaps the written bytes so self-modifying ROMs keep
+// executing what is actually in memory. A store running past the end of
+// memory wraps around to address 0, and so does the range.
+void chip8::invalidate_decoded(const uint16_t address, const uint16_t length) {
+  if ((address + length) > memory.size()) {
+    invalidate_decoded(0, static_cast<uint16_t>(address + length -
+                                                 memory.size()));
+    invalidate_decoded(address,
+                       static_cast<uint16_t>(memory.size() - address));
+    return;
+  }
+  if (length == 0) {
+    return;
+  }
+  const std::size_t first = (address == 0) ? 0 : (address - 1U) / 2;
+  const std::size_t last = (address + length - 1U) / 2;
+  for (std::size_t i = first; i <= last; ++i) {
+    decoded_cache[i] = decode(
+        static_cast<uint16_t>((memory[2 * i] << 8) | memory[(2 * i) + 1]));
+  }
+  // The entry before the first one pairs with it as well
+  fuse_decoded((first == 0) ? 0 : (first - 1), last);
+#ifdef CHIP8_HAS_JIT
+  if (jit) {
+    jit->invalidate(address, length);
+  }
+#endif
+  if (aot) {
+    for (std::size_t i = 0; i < aot->block_count; ++i) {
+      const auto &blk = aot->blocks[i];
+      if ((blk.start < (address + length)) && (blk.end > address)) {
+        aot_stale.set(blk.start);
+      }
+    }
+  }
+}
+
+bool chip8::attach_aot(const aot_rom *rom) {
+  if (!rom) {
+    return false;
+  }
+  if ((prog_mem_begin + rom->image_size) > memory.size()) {
+    ESP_LOGE(FILE_TAG, "AOT translation does not fit in program memory");
+    return false;
+  }
+  // Only the translated code has to match. A game resumed from a save
+  // state may have written into its ROM area, e.g. FX33 scratch bytes,
+  // and the blocks it wrote over run through the interpreter.
+  aot = rom;
+  aot_stale.reset();
+  for (std::size_t i = 0; i < rom->block_count; ++i) {
+    const auto &blk = rom->blocks[i];
+    const std::size_t image_begin = blk.start - prog_mem_begin;
+    const std::size_t image_end = blk.end - prog_mem_begin;
+    if ((blk.start < prog_mem_begin) || (image_end > rom->image_size) ||
+        !std::equal(rom->image + image_begin, rom->image + image_end,
+                    memory.begin() + blk.start)) {
+      aot_stale.set(blk.start);
+    }
+  }
+  return true;
+}
+
+void chip8::save_state(saved_state &out) const {
+  state_writer field{out.data()};
+  field.bytes(reinterpret_cast<const uint8_t *>("C8SS"), 4);
+  field.u16(save_state_version);
+  field.u16(0);
+  field.bytes(memory.data(), memory.size());
+  field.bytes(V.data(), V.size());
+  field.u16(I);
+  field.u16(prog_counter);
+  field.u8(delay_timer);
+  field.u8(sound_timer);
+  field.u8(static_cast<uint8_t>(hw_stack.size()));
+  for (std::size_t i = 0; i < call_stack::capacity; ++i) {
+    field.u16((i < hw_stack.size()) ? hw_stack.begin()[i] : 0);
+  }
+  field.u32(faults.overflows);
+  field.u32(faults.underflows);
+  for (const uint64_t row : display) {
+    field.u64(row);
+  }
+  field.u32(rng.get_state());
+  field.u32(cycles_per_frame);
+  field.u32(timer_phase);
+  const key_snapshot keys = numpad ? numpad->keySnapshot() : key_snapshot{0, 0};
+  field.u16(keys.down);
+  field.u16(keys.latched);
+  field.u8(isDisplaySet ? 1 : 0);
+}
+
+bool chip8::load_state(const uint8_t *state, const std::size_t size) {
+  if ((size != save_state_size) || !std::equal(state, state + 4, "C8SS")) {
+    ESP_LOGE(FILE_TAG, "Not a save state");
+    return false;
+  }
+  state_reader field{state + 4};
+  if (field.u16() != save_state_version) {
+    ESP_LOGE(FILE_TAG, "Save state version is not %u", save_state_version);
+    return false;
+  }
+  static_cast<void>(field.u16());
+  const uint8_t *saved_memory = field.skip(memory.size());
+  std::copy_n(field.skip(V.size()), V.size(), V.begin());
+  I = field.u16();
+  prog_counter = static_cast<uint16_t>(field.u16() & 0x0FFFU);
+  delay_timer = field.u8();
+  sound_timer = field.u8();
+  const std::size_t depth =
+      std::min<std::size_t>(field.u8(), call_stack::capacity);
+  hw_stack.clear();
+  for (std::size_t i = 0; i < call_stack::capacity; ++i) {
+    const uint16_t address = field.u16();
+    if (i < depth) {
+      static_cast<void>(hw_stack.push(address));
+    }
+  }
+  faults.overflows = field.u32();
+  faults.underflows = field.u32();
+  for (uint64_t &row : display) {
+    row = field.u64();
+  }
+  rng.set_state(field.u32());
+  set_cycles_per_frame(field.u32());
+  timer_phase = field.u32() % cycles_per_frame;
+  key_snapshot keys{};
+  keys.down = field.u16();
+  keys.latched = field.u16();
+  if (numpad) {
+    numpad->restoreKeySnapshot(keys);
+  }
+  isDisplaySet = (field.u8() != 0);
+  stop_request = run_stop::budget;
+  damage.add_all();
+
+  // Resuming where the snapshot was taken usually leaves most of memory
+  // as it is, so only the span that differs is copied and re-decoded
+  const auto first =
+      std::mismatch(memory.begin(), memory.end(), saved_memory).first;
+  if (first != memory.end()) {
+    const auto begin = static_cast<std::size_t>(first - memory.begin());
+    std::size_t end = memory.size();
+    while (memory[end - 1] == saved_memory[end - 1]) {
+      --end;
+    }
+    std::copy(saved_memory + begin, saved_memory + end, first);
+    invalidate_decoded(static_cast<uint16_t>(begin),
+                       static_cast<uint16_t>(end - begin));
+  }
+  return true;
 }
 
-std::array<uint8_t, 16> chip8::get_V_registers() const { return V; }
-std::array<uint8_t, 4096> chip8::get_memory_dump() const { return memory; }
-std::stack<uint16_t> chip8::get_stack() const { return hw_stack; }
+cpu_state chip8::get_cpu_state() const {
+  return {V, hw_stack, I, prog_counter, delay_timer, sound_timer,
+          hw_stack.size(), get_pressed_keys()};
+}
+
+const std::array<uint8_t, 16> &chip8::get_V_registers() const { return V; }
+const std::array<uint8_t, 4096> &chip8::get_memory_dump() const {
+  return memory;
+}
+const call_stack &chip8::get_stack() const { return hw_stack; }
+stack_faults chip8::get_stack_faults() const { return faults; }
 
 uint16_t chip8::get_prog_counter() const { return prog_counter; }
 uint8_t chip8::get_delay_counter() const { return delay_timer; }
 uint8_t chip8::get_sound_counter() const { return sound_timer; }
-std::string chip8::get_instruction() const { return instruction; }
+
+uint16_t chip8::get_pressed_keys() const {
+  return numpad ? numpad->pressedKeys() : 0;
+}
+
+std::array<bool, 16> chip8::get_Keys_array() const {
+  std::array<bool, 16> keys{false};
+  const uint16_t pressed = get_pressed_keys();
+  for (std::size_t key = 0; key < keys.size(); ++key) {
+    keys[key] = ((pressed >> key) & 1U) != 0;
+  }
+  return keys;
+}
 uint16_t chip8::get_I_register() const { return I; }
 bool chip8::get_display_flag() const { return isDisplaySet; }
 
-const std::array<uint8_t, display_size> &chip8::get_display_pixels() const {
-  return display;
+std::array<uint8_t, display_size> chip8::get_display_pixels() const {
+  std::array<uint8_t, display_size> pixels{0};
+  for (std::size_t y = 0; y < display_y; ++y) {
+    for (std::size_t x = 0; x < display_x; ++x) {
+      pixels[(y * display_x) + x] =
+          static_cast<uint8_t>((display[y] >> (display_x - 1 - x)) & 1U);
+    }
+  }
+  return pixels;
+}
+
+const display_rows &chip8::get_display_rows() const { return display; }
+
+display_damage chip8::take_display_damage() {
+  return std::exchange(damage, display_damage{});
+}
+
+void chip8::set_dispatch_mode(const dispatch_mode new_mode) {
+  if (new_mode == dispatch_mode::jit) {
+#ifdef CHIP8_HAS_JIT
+    if (!jit) {
+      jit = std::make_unique<jit_x86_64>();
+    }
+    if (!jit->ready()) {
+      ESP_LOGE(FILE_TAG, "JIT could not be initialised, keeping mode %d",
+               static_cast<int>(mode));
+      jit.reset();
+      return;
+    }
+#else
+    ESP_LOGE(FILE_TAG, "JIT is not supported on this target");
+    return;
+#endif
+  }
+  mode = new_mode;
+}
+dispatch_mode chip8::get_dispatch_mode() const { return mode; }
+
+void chip8::get_profile(vm_profile &snapshot) const {
+#ifdef CONFIG_CHIP8_PROFILER
+  snapshot = profile;
+#else
+  snapshot.clear();
+#endif
+}
+
+void chip8::reset_profile() {
+#ifdef CONFIG_CHIP8_PROFILER
+  profile.clear();
+#endif
+}
+
+bool chip8::write_trace([[maybe_unused]] std::FILE *out) const {
+#ifdef CONFIG_CHIP8_TRACE
+  return trace.write(out);
+#else
+  return false;
+#endif
+}
+
+void chip8::clear_trace() {
+#ifdef CONFIG_CHIP8_TRACE
+  trace.clear();
+#endif
+}
+
+uint32_t chip8::rewind([[maybe_unused]] const uint32_t frames) {
+#ifdef CONFIG_CHIP8_REWIND
+  if (history.empty()) {
+    return 0;
+  }
+  const uint32_t back = history.restore(frames, history_frame);
+  static_cast<void>(load_state(history_frame));
+  return back;
+#else
+  return 0;
+#endif
+}
+
+uint32_t chip8::get_rewind_frames() const {
+#ifdef CONFIG_CHIP8_REWIND
+  return history.frames();
+#else
+  return 0;
+#endif
+}
+
+void chip8::clear_rewind() {
+#ifdef CONFIG_CHIP8_REWIND
+  history.clear();
+#endif
+}
+
+// chip8 as the Machine of the handlers in handlers.hpp
+struct chip8::machine {
+  chip8 &vm;
+
+  uint8_t &v(const uint8_t index) { return vm.V[index]; }
+  uint16_t &i() { return vm.I; }
+  uint16_t &pc() { return vm.prog_counter; }
+  uint8_t &delay() { return vm.delay_timer; }
+  uint8_t &sound() { return vm.sound_timer; }
+  [[nodiscard]] uint8_t read(const uint16_t address) const {
+    return vm.memory[address];
+  }
+  void write(const uint16_t address, const uint8_t value) {
+    vm.memory[address] = value;
+  }
+  // The decoded and translated forms of what was written are stale now
+  void stored(const uint16_t address, const uint16_t length) {
+    vm.invalidate_decoded(address, length);
+  }
+  bool push(const uint16_t address) { return vm.hw_stack.push(address); }
+  bool pop(uint16_t &address) { return vm.hw_stack.pop(address); }
+  void stack_overflow() { vm.report_stack_overflow(); }
+  void stack_underflow() { vm.report_stack_underflow(); }
+  display_rows &rows() { return vm.display; }
+  void clear_display() {
+    vm.clear_display();
+    vm.isDisplaySet = true;
+  }
+  // The rows and columns a sprite covered are display damage
+  void drew(const uint32_t rows, const uint8_t first, const uint8_t last) {
+    if (rows != 0) {
+      vm.damage.add(rows, first, last);
+    }
+    vm.isDisplaySet = true;
+  }
+  uint8_t random_byte() { return vm.rng.next_byte(); }
+  keyboard *keys() { return vm.numpad; }
+  void key_wait() { vm.stop_request = run_stop::key_wait; }
+  void check_exit() { vm.check_exit_request(); }
+  void unknown() {
+    ESP_LOGD(FILE_TAG, "Unrecognized opcode: {%#x} \n",
+             (vm.memory[(vm.prog_counter - 2U) & 0x0FFFU] << 8) |
+                 vm.memory[(vm.prog_counter - 1U) & 0x0FFFU]);
+  }
+};
+
+// Jump straight to the handler for an already decoded instruction. The
+// compiler turns the dense switch of execute_on() into a single indirect
+// jump and inlines the handlers, which beats calling through a member
+// function pointer.
+inline void chip8::execute(const decoded_instruction &ins) {
+  machine self{*this};
+  execute_on(self, ins);
 }
 
 void chip8::step_one_cycle() {
+  const uint16_t pc = prog_counter;
+  const auto opcode = static_cast<uint16_t>((memory[pc] << 8) |
+                                            memory[(pc + 1U) & 0x0FFFU]);
+  if (mode == dispatch_mode::reference) {
+    step_reference();
+    trace_step(pc, opcode);
+    return;
+  }
+  decoded_instruction ins;
+  if ((mode != dispatch_mode::table) && ((prog_counter & 1U) == 0)) {
+    ins = decoded_cache[prog_counter >> 1];
+  } else {
+    // The memory is read in big endian, i.e., MSB first
+    ins = decode(static_cast<uint16_t>(
+        (memory[prog_counter] << 8) | memory[(prog_counter + 1U) & 0x0FFFU]));
+  }
+  profile_hit(prog_counter, ins.id);
+  prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
+
+  tick_timers(1);
+  isDisplaySet = false;
+  execute(ins);
+  trace_step(pc, opcode);
+}
+
+// Translated code never tells which instructions ran, so the profiler
+// runs jit and aot through the predecoded interpreter instead. The trace
+// needs the state after every single instruction, so it also skips the
+// superinstructions.
+uint32_t chip8::step_cycles(const uint32_t cycles) {
+#if !defined(CONFIG_CHIP8_PROFILER) && !defined(CONFIG_CHIP8_TRACE)
+#ifdef CHIP8_HAS_JIT
+  if (mode == dispatch_mode::jit) {
+    return jit->run(*this, cycles);
+  }
+#endif
+  if (mode == dispatch_mode::aot) {
+    return run_aot(cycles);
+  }
+#endif
+#ifndef CONFIG_CHIP8_TRACE
+  if (mode == dispatch_mode::fused) {
+    return run_fused(cycles);
+  }
+#endif
+  bool drawn = false;
+  uint32_t done = 0;
+  while ((done < cycles) && (stop_request == run_stop::budget)) {
+    step_one_cycle();
+    drawn = drawn || isDisplaySet;
+    ++done;
+  }
+  isDisplaySet = drawn;
+  return done;
+}
+
+run_summary chip8::run_cycles(const uint32_t cycles) {
+  stop_request = run_stop::budget;
+  const uint32_t done = step_cycles(cycles);
+  return {done, isDisplaySet, sound_timer > 0, stop_request};
+}
+
+run_summary chip8::run_frame() {
+  run_summary frame = run_cycles(cycles_per_frame);
+  // A game waiting for a key would spend the rest of the frame repeating
+  // FX0A, so the rest of the frame passes for the timers all the same
+  if (frame.reason == run_stop::key_wait) {
+    tick_timers(cycles_per_frame - frame.cycles);
+    frame.sound_active = sound_timer > 0;
+  }
+  if (numpad) {
+    numpad->endFrame();
+  }
+  rewind_capture();
+  return frame;
+}
+
+void chip8::set_cycles_per_frame(const uint32_t cycles) {
+  cycles_per_frame = std::max<uint32_t>(cycles, 1);
+}
+
+// One or more 60 Hz periods of emulated time have passed since the timers
+// last counted down
+void chip8::expire_timer_periods() {
+  const uint32_t periods = timer_phase / cycles_per_frame;
+  timer_phase -= periods * cycles_per_frame;
+  delay_timer = (delay_timer > periods)
+                    ? static_cast<uint8_t>(delay_timer - periods)
+                    : 0;
+  sound_timer = (sound_timer > periods)
+                    ? static_cast<uint8_t>(sound_timer - periods)
+                    : 0;
+}
+
+uint32_t chip8::get_cycles_per_frame() const { return cycles_per_frame; }
+
+// Only the keypad instructions poll the keyboard, so they are the only
+// place an exit request can show up while the VM runs
+void chip8::check_exit_request() {
+  if (numpad && numpad->isExitRequested()) {
+    stop_request = run_stop::exit;
+  }
+}
+
+// Only the first fault of each kind is logged, a runaway recursion would
+// flood the console otherwise
+void chip8::report_stack_overflow() {
+  if (faults.overflows++ == 0) {
+    ESP_LOGE(FILE_TAG, "Call stack overflow at %#x, return address lost",
+             prog_counter - 2);
+  }
+}
+
+void chip8::report_stack_underflow() {
+  if (faults.underflows++ == 0) {
+    ESP_LOGE(FILE_TAG, "Return at %#x with an empty call stack ignored",
+             prog_counter - 2);
+  }
+}
+
+// Only rows that had pixels set count as damage
+void chip8::clear_display() {
+  uint32_t rows = 0;
+  uint64_t columns = 0;
+  for (uint8_t y = 0; y < display_y; y++) {
+    if (display[y] != 0) {
+      rows |= uint32_t{1} << y;
+      columns |= display[y];
+      display[y] = 0;
+    }
+  }
+  if (rows != 0) {
+    damage.add(rows, static_cast<uint8_t>(__builtin_clzll(columns)),
+               static_cast<uint8_t>(display_x - 1 - __builtin_ctzll(columns)));
+  }
+}
+
+void chip8::execute_opcode(const uint16_t opcode) { execute(decode(opcode)); }
+
+// Execute the superinstruction starting with first and return how many
+// guest instructions that took: 2, or 1 if first skipped the second. The
+// timers and the program counter advance exactly as if both went through
+// step_one_cycle(). Only skips look at the program counter, so the other
+// pairs advance it once up front.
+inline uint32_t chip8::execute_fused(const decoded_instruction &first) {
+  const decoded_instruction &second = decoded_cache[(prog_counter >> 1) + 1];
+  machine self{*this};
+  switch (first.fused) {
+  case fused_id::op_ANNN_DXYN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_ANNN(self, first);
+    exec_DXYN(self, second);
+    return 2;
+  case fused_id::op_ANNN_FX1E:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_ANNN(self, first);
+    exec_FX1E(self, second);
+    return 2;
+  case fused_id::op_DXYN_3XNN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_DXYN(self, first);
+    exec_3XNN(self, second);
+    return 2;
+  case fused_id::op_DXYN_7XNN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_DXYN(self, first);
+    exec_7XNN(self, second);
+    return 2;
+  case fused_id::op_FX07_3XNN:
+    // FX07 reads the delay timer, so it has to see exactly one tick
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(1);
+    exec_FX07(self, first);
+    tick_timers(1);
+    exec_3XNN(self, second);
+    return 2;
+  case fused_id::op_7XNN_3XNN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_7XNN(self, first);
+    exec_3XNN(self, second);
+    return 2;
+  case fused_id::op_7XNN_4XNN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_7XNN(self, first);
+    exec_4XNN(self, second);
+    return 2;
+  case fused_id::op_7XNN_7XNN:
+    prog_counter = static_cast<uint16_t>((prog_counter + 4) & 0x0FFF);
+    tick_timers(2);
+    exec_7XNN(self, first);
+    exec_7XNN(self, second);
+    return 2;
+  case fused_id::op_3XNN_1NNN:
+  case fused_id::op_4XNN_1NNN: {
+    const auto next = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
+    prog_counter = next;
+    tick_timers(1);
+    if (first.fused == fused_id::op_3XNN_1NNN) {
+      exec_3XNN(self, first);
+    } else {
+      exec_4XNN(self, first);
+    }
+    if (prog_counter != next) {
+      return 1;
+    }
+    prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
+    tick_timers(1);
+    exec_1NNN(self, second);
+    return 2;
+  }
+  default:
+    break;
+  }
+  return 0;
+}
+
+// The step_cycles() loop for dispatch_mode::fused. Runs a superinstruction
+// whenever the program counter is at the start of one and at least two
+// instructions are left in the budget. Handlers only ever set the display
+// flag, so clearing it once up front leaves it set if any of them drew.
+uint32_t chip8::run_fused(const uint32_t cycles) {
+  uint32_t budget = cycles;
+  isDisplaySet = false;
+  while ((budget > 0) && (stop_request == run_stop::budget)) {
+    decoded_instruction ins;
+    if ((prog_counter & 1U) == 0) {
+      ins = decoded_cache[prog_counter >> 1];
+      if ((ins.fused != fused_id::none) && (budget >= 2)) {
+        const uint16_t pc = prog_counter;
+        const uint32_t done = execute_fused(ins);
+        profile_hit(pc, ins.id);
+        if (done == 2) {
+          profile_hit(static_cast<uint16_t>(pc + 2),
+                      decoded_cache[(pc >> 1) + 1].id);
+        }
+        budget -= done;
+        continue;
+      }
+    } else {
+      ins = decode(static_cast<uint16_t>(
+          (memory[prog_counter] << 8) | memory[(prog_counter + 1U) & 0x0FFFU]));
+    }
+    profile_hit(prog_counter, ins.id);
+    prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
+    tick_timers(1);
+    execute(ins);
+    --budget;
+  }
+  return cycles - budget;
+}
+
+// Runs whole translated blocks while the budget allows it. Blocks hand over
+// their successor directly when it is known at translation time; the rest
+// is looked up by address. Addresses without a block (targets of BNNN,
+// code the translator never reached) and blocks the guest wrote over go
+// through the interpreter instead.
+uint32_t chip8::run_aot(const uint32_t cycles) {
+  uint32_t budget = cycles;
+  bool drawn = false;
+  uint16_t next = aot_dynamic_exit;
+  while ((budget > 0) && (stop_request == run_stop::budget)) {
+    const aot_block *blk = nullptr;
+    if (aot) {
+      if (next != aot_dynamic_exit) {
+        blk = &aot->blocks[next];
+      } else {
+        const auto *end = aot->blocks + aot->block_count;
+        const auto *it = std::lower_bound(
+            aot->blocks, end, prog_counter,
+            [](const aot_block &b, uint16_t pc) { return b.start < pc; });
+        if ((it != end) && (it->start == prog_counter)) {
+          blk = it;
+        }
+      }
+      if (blk && aot_stale[blk->start]) {
+        blk = nullptr;
+      }
+    }
+    if (!blk || (blk->length > budget)) {
+      step_one_cycle();
+      drawn = drawn || isDisplaySet;
+      --budget;
+      next = aot_dynamic_exit;
+      continue;
+    }
+    isDisplaySet = false;
+    next = blk->fn(*this);
+    drawn = drawn || isDisplaySet;
+    budget -= blk->length;
+  }
+  isDisplaySet = drawn;
+  return cycles - budget;
+}
+
+// Original decoder: a switch on the first nibble followed by if/else
+// chains on the remaining nibbles. Selected with dispatch_mode::reference.
+void chip8::step_reference() {
   // The memory is read in big endian, i.e., MSB first
-  auto opcode = static_cast<uint16_t>((memory[prog_counter] << 8) |
-                                      (memory[prog_counter + 1U]));
+  auto opcode = static_cast<uint16_t>(
+      (memory[prog_counter] << 8) | memory[(prog_counter + 1U) & 0x0FFFU]);
+  profile_hit(prog_counter, classify(opcode));
   // Each cycle reads two consecutive opcodes
   // -Wconversion requires this cast as 2 will be implicitly
   // turned to an int
-  prog_counter = static_cast<uint16_t>(prog_counter + 2);
+  prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
 
-  if (delay_timer > 0) {
-    --delay_timer;
-  }
-  if (sound_timer > 0) {
-    // Use SFML to BEEP
-    --sound_timer;
-  }
+  tick_timers(1);
   isDisplaySet = false;
   switch (first_nibble(opcode)) {
   // OPCODE 6XNN: Store number NN in register VX
   case (0x6000): {
     const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
     V[Vx] = last_two_nibbles(opcode);
-    ESP_LOGD(FILE_TAG, "6XNN: LD {%#x}, {%#x}", Vx, V[Vx]);
     break;
   }
   case (0x8000): {
@@ -183,8 +816,6 @@ void chip8::step_one_cycle() {
     if (last_nibble(opcode) == 0) {
       const auto [Vx, Vy] = get_XY_nibbles(opcode);
       V[Vx] = V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XY0: LD {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY4 : Add the value of register VY to register VX
     // Set VF to 01 if a carry occurs else to 0
@@ -194,8 +825,6 @@ void chip8::step_one_cycle() {
       // mask the sum with 0b100000000 (0x100) to get the overflow bit
       V[0xF] = static_cast<uint8_t>((sum & 0x100) >> 8);
       V[Vx] = static_cast<uint8_t>(sum);
-
-      ESP_LOGD(FILE_TAG, "8XY4: ADD {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY5 : Subtract the value of register VY from register VX
     // Set VF to 01 if a borrow does not occur, else to 0
@@ -207,8 +836,6 @@ void chip8::step_one_cycle() {
         V[0xF] = 0;
       }
       V[Vx] = static_cast<uint8_t>(V[Vx] - V[Vy]);
-
-      ESP_LOGD(FILE_TAG, "8XY5: SUB {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY7 : Set register VX to the value of VY minus VX
     // Set VF to 01 if a borrow does not occur, else to 0
@@ -220,29 +847,21 @@ void chip8::step_one_cycle() {
         V[0xF] = 0;
       }
       V[Vx] = static_cast<uint8_t>(V[Vy] - V[Vx]);
-
-      ESP_LOGD(FILE_TAG, "8XY7: SUBN {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY2 : Set VX to VX AND VY
     else if (last_nibble(opcode) == 2) {
       const auto [Vx, Vy] = get_XY_nibbles(opcode);
       V[Vx] = V[Vx] & V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XY2: AND {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY1 : Set VX to VX OR VY
     else if (last_nibble(opcode) == 1) {
       const auto [Vx, Vy] = get_XY_nibbles(opcode);
       V[Vx] = V[Vx] | V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XY1: OR {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY3 : Set VX to VX XOR VY
     else if (last_nibble(opcode) == 3) {
       const auto [Vx, Vy] = get_XY_nibbles(opcode);
       V[Vx] = V[Vx] ^ V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XY3: XOR {%#x}, {%#x}", Vx, Vy);
     }
     // OPCODE 8XY6 : Store the value of register VY
     // shifted right one bit in register VX
@@ -254,8 +873,6 @@ void chip8::step_one_cycle() {
       V[0xF] = V[Vy] & 0x01;
       V[Vy] = static_cast<uint8_t>(V[Vy] >> 1);
       V[Vx] = V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XY6: SHR {%#x}, {{,{%#x}}}", Vx, Vy);
     }
     // OPCODE 8XYE : Store the value of register VY
     //  shifted left one bit in register VX
@@ -267,8 +884,6 @@ void chip8::step_one_cycle() {
       V[0xF] = static_cast<uint8_t>((V[Vy] & 0x80) >> 7);
       V[Vy] = static_cast<uint8_t>(V[Vy] << 1);
       V[Vx] = V[Vy];
-
-      ESP_LOGD(FILE_TAG, "8XYE: SHL {%#x}, {{,{%#x}}}", Vx, Vy);
     } else {
       ESP_LOGD(FILE_TAG, "Unrecognized opcode: {%#x} \n", opcode);
     }
@@ -282,60 +897,45 @@ void chip8::step_one_cycle() {
     // 255
     const auto NN = V[Vx];
     V[Vx] = static_cast<uint8_t>((last_two_nibbles(opcode) + NN));
-
-    ESP_LOGD(FILE_TAG, "7XNN: ADD {%#x}, {%#x}", Vx, NN);
     break;
   }
   // OPCODE CXNN : Set VX to a random number with a mask of NN
   case (0xC000): {
     const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
     const uint8_t mask = last_two_nibbles(opcode);
-    std::random_device rseed;
-    std::mt19937 rgen(rseed()); // mersenne_twister
-    std::uniform_int_distribution<int> idist(0, 255);
-
-    V[Vx] = static_cast<uint8_t>(idist(rgen) & mask);
-
-    ESP_LOGD(FILE_TAG, "CXNN: RND {%#x}, {%#x}", Vx, V[Vx]);
+    V[Vx] = static_cast<uint8_t>(rng.next_byte() & mask);
     break;
   }
   // OPCODE 1NNN : Jump to address NNN
   case (0x1000): {
     prog_counter = last_three_nibbles(opcode);
-
-    ESP_LOGD(FILE_TAG, "1NNN: JMP {%#x}", prog_counter);
     break;
   }
   // OPCODE BNNN : Jump to address NNN + V0
   case (0xB000): {
     prog_counter =
         static_cast<uint16_t>(last_three_nibbles(opcode) + V[0]) & 0x0FFF;
-
-    ESP_LOGD(FILE_TAG, "BNNN: JMP {%#x}, {%#x}", V[0], prog_counter);
     break;
   }
   // OPCODE 2NNN : Execute subroutine starting at address NNN
   case (0x2000): {
-    hw_stack.push(prog_counter);
+    if (!hw_stack.push(prog_counter)) {
+      report_stack_overflow();
+    }
     prog_counter = last_three_nibbles(opcode) & 0x0FFF;
-
-    ESP_LOGD(FILE_TAG, "2NNN: CALL {%#x}", prog_counter);
     break;
   }
   case (0x0000): {
     // OPCODE 00EE : Return from a subroutine
     if (last_two_nibbles(opcode) == 0xEE) {
-      prog_counter = hw_stack.top();
-      hw_stack.pop();
-
-      ESP_LOGD(FILE_TAG, "00EE: RET");
+      if (!hw_stack.pop(prog_counter)) {
+        report_stack_underflow();
+      }
     }
     // OPCODE 00E0 : Clear display
     else if (last_two_nibbles(opcode) == 0xE0) {
-      display = {0};
+      clear_display();
       isDisplaySet = true;
-
-      ESP_LOGD(FILE_TAG, "00E0: CLS");
     } else {
       ESP_LOGD(FILE_TAG, "Unrecognized opcode: {%#x} \n", opcode);
     }
@@ -349,8 +949,6 @@ void chip8::step_one_cycle() {
     if (V[Vx] == cmp_value) {
       prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
     }
-
-    ESP_LOGD(FILE_TAG, "3XNN: SE {%#x}, {%#x}", Vx, cmp_value);
     break;
   }
   // OPCODE 4XNN : Skip the following instruction
@@ -361,8 +959,6 @@ void chip8::step_one_cycle() {
     if (V[Vx] != cmp_value) {
       prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
     }
-
-    ESP_LOGD(FILE_TAG, "4XNN: SNE {%#x}, {%#x}", Vx, cmp_value);
     break;
   }
   // OPCODE 5XNN : Skip the following instruction if the value
@@ -372,8 +968,6 @@ void chip8::step_one_cycle() {
     if (V[Vx] == V[Vy]) {
       prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
     }
-
-    ESP_LOGD(FILE_TAG, "5XNN: SE {%#x}, {%#x}", Vx, Vy);
     break;
   }
   // OPCODE 9XNN : Skip the following instruction if the value
@@ -383,8 +977,6 @@ void chip8::step_one_cycle() {
     if (V[Vx] != V[Vy]) {
       prog_counter = static_cast<uint16_t>(prog_counter + 2) & 0x0FFF;
     }
-
-    ESP_LOGD(FILE_TAG, "9XNN: SNE {%#x}, {%#x}", Vx, Vy);
     break;
   }
   case (0xF000): {
@@ -392,51 +984,44 @@ void chip8::step_one_cycle() {
     if (last_two_nibbles(opcode) == 0x15) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
       delay_timer = V[Vx];
-
-      ESP_LOGD(FILE_TAG, "FX15: LD {%#x}, {%#x}", delay_timer, Vx);
     }
     // OPCODE FX07: Store the current value of the delay timer in register VX
     else if (last_two_nibbles(opcode) == 0x07) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
       V[Vx] = delay_timer;
-
-      ESP_LOGD(FILE_TAG, "FX07: LD {%#x}, {%#x}", Vx, delay_timer);
     }
     // OPCODE FX18: Set the sound timer to the value of register VX
     else if (last_two_nibbles(opcode) == 0x18) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
       sound_timer = V[Vx];
-
-      ESP_LOGD(FILE_TAG, "FX18: LD {%#x}, {%#x}", sound_timer, Vx);
     }
     // OPCODE FX29: Set I to the memory address of the sprite data
     // corresponding to the hexadecimal digit stored in register VX
     else if (last_two_nibbles(opcode) == 0x29) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
       I = static_cast<uint16_t>(5 * V[Vx]);
-
-      ESP_LOGD(FILE_TAG, "FX29: LD {%#x}, {%#x}", I, Vx);
     }
     // OPCODE FX33: Store the binary-coded decimal equivalent of
     // the value stored in register VX at addresses I, I+1, and I+2
     else if (last_two_nibbles(opcode) == 0x33) {
       const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
       const auto [MSB, MidB, LSB] = parse_BCD(V[Vx]);
-      memory[I] = MSB;
-      memory[I + 1] = MidB;
-      memory[I + 2] = LSB;
-
-      ESP_LOGD(FILE_TAG, "FX33: LD {%#x}, {%#x}", V[Vx], Vx);
+      memory[I & 0x0FFFU] = MSB;
+      memory[(I + 1U) & 0x0FFFU] = MidB;
+      memory[(I + 2U) & 0x0FFFU] = LSB;
+      invalidate_decoded(static_cast<uint16_t>(I & 0x0FFFU), 3);
     }
     // OPCODE FX55: Store the values of registers V0 to VX
     // inclusive in memory starting at address I
     // I is set to I + X + 1 after operation
     else if (last_two_nibbles(opcode) == 0x55) {
       const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      std::copy_n(V.begin(), (Vx + 1), (memory.begin() + I));
+      for (size_t i = 0; i <= Vx; i++) {
+        memory[(I + i) & 0x0FFFU] = V[i];
+      }
+      invalidate_decoded(static_cast<uint16_t>(I & 0x0FFFU),
+                         static_cast<uint16_t>(Vx + 1));
       I = static_cast<uint16_t>(I + Vx + 1);
-
-      ESP_LOGD(FILE_TAG, "FX55: LD [{%#x}], {%#x}", I, Vx);
     }
     // OPCODE FX65: Fill registers V0 to VX
     // inclusive with the values stored in memory starting at address I
@@ -444,31 +1029,27 @@ void chip8::step_one_cycle() {
     else if (last_two_nibbles(opcode) == 0x65) {
       const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
       for (size_t i = 0; i <= Vx; i++) {
-        V[i] = memory[I + i];
+        V[i] = memory[(I + i) & 0x0FFFU];
       }
       I = static_cast<uint16_t>(I + Vx + 1);
-
-      ESP_LOGD(FILE_TAG, "FX65: LD  {%#x}, [{%#x}]", Vx, I);
     }
     // OPCODE FX0A: Wait for a keypress and store the result in register VX
     else if (last_two_nibbles(opcode) == 0x0A) {
       const auto Vx = static_cast<uint8_t>((second_nibble(opcode) >> 8));
-      auto index = numpad->whichKeyIndexIfPressed();
+      auto index = numpad ? numpad->whichKeyIndexIfPressed() : std::nullopt;
       if (index) {
         V[Vx] = index.value();
       } else {
         // reset the counter to repeat this opcode until key is pressed
-        prog_counter = static_cast<uint16_t>(prog_counter - 2);
+        prog_counter = static_cast<uint16_t>((prog_counter - 2) & 0x0FFF);
+        stop_request = run_stop::key_wait;
       }
-
-      ESP_LOGD(FILE_TAG, "FX0A: LDK {%#x}, {%#x}", Vx, V[Vx]);
+      check_exit_request();
     }
     // OPCODE FX1E: Add the value stored in register VX to register I
     else if (last_two_nibbles(opcode) == 0x1E) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
       I = static_cast<uint16_t>(I + V[Vx]);
-
-      ESP_LOGD(FILE_TAG, "FX1E: ADD {%#x}, {%#x}", I, Vx);
     } else {
       ESP_LOGD(FILE_TAG, "Unrecognized opcode: {%#x} \n", opcode);
     }
@@ -477,8 +1058,6 @@ void chip8::step_one_cycle() {
   // OPCODE ANNN: Store memory address NNN in register I
   case (0xA000): {
     I = last_three_nibbles(opcode);
-
-    ESP_LOGD(FILE_TAG, "ANNN: LD I, {%#x}", I);
     break;
   }
   // OPCODE DXYN: Draw a sprite at position VX, VY with N bytes
@@ -488,26 +1067,23 @@ void chip8::step_one_cycle() {
   case (0xD000): {
     const auto [Vx, Vy] = get_XY_nibbles(opcode);
     const auto N = last_nibble(opcode);
+    const auto x = static_cast<uint8_t>(V[Vx] % display_x);
+    const auto y = static_cast<uint8_t>(V[Vy] % display_y);
 
-    for (uint16_t y = 0; y < N; y++) {
-      auto pos = static_cast<uint16_t>(V[Vx] + (display_x * (y + V[Vy])));
-      pos = (pos > display_size) ? display_size : pos;
-      uint8_t sprite = memory.at(static_cast<uint16_t>(I + y));
-
-      for (uint16_t x = 0; x < 8; x++) {
-        auto actual_pos = static_cast<uint16_t>(pos + x);
-        if ((sprite & (0x80 >> x))) {
-          V[0xF] = 0;
-          if (!(display[actual_pos] ^ (1))) {
-            V[0xF] = 1;
-          }
-          display[actual_pos] = static_cast<uint8_t>(display[actual_pos] ^ (1));
-        }
-      }
+    uint64_t collision = 0;
+    uint8_t row = 0;
+    for (; (row < N) && ((y + row) < display_y); row++) {
+      const uint64_t sprite =
+          (uint64_t{memory[(I + row) & 0x0FFFU]} << (display_x - 8)) >> x;
+      collision |= display[y + row] & sprite;
+      display[y + row] ^= sprite;
+    }
+    if (row != 0) {
+      damage.add(((uint32_t{1} << row) - 1U) << y, x,
+                 static_cast<uint8_t>(std::min(x + 7, display_x - 1)));
     }
+    V[0xF] = (collision != 0) ? 1 : 0;
     isDisplaySet = true;
-
-    ESP_LOGD(FILE_TAG, "DXYN: DRW {%#x}, {%#x}, {%#x}", Vx, Vy, N);
     break;
   }
   case (0xE000): {
@@ -515,21 +1091,19 @@ void chip8::step_one_cycle() {
     // corresponding to the hex value currently stored in register VX is pressed
     if (last_two_nibbles(opcode) == 0x9E) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      if (numpad->isKeyVxPressed(V[Vx])) {
-        prog_counter = static_cast<uint16_t>(prog_counter + 2);
+      if (numpad && numpad->isKeyVxPressed(V[Vx])) {
+        prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
       }
-
-      ESP_LOGD(FILE_TAG, "EX9E: SKP {%#x}", Vx);
+      check_exit_request();
     }
     // OPCODE EXA1: Skip the following instruction if the key corresponding
     // to the hex value currently stored in register VX is not pressed
     else if (last_two_nibbles(opcode) == 0xA1) {
       const auto Vx = static_cast<uint8_t>(second_nibble(opcode) >> 8);
-      if (!numpad->isKeyVxPressed(V[Vx])) {
-        prog_counter = static_cast<uint16_t>(prog_counter + 2);
+      if (!numpad || !numpad->isKeyVxPressed(V[Vx])) {
+        prog_counter = static_cast<uint16_t>((prog_counter + 2) & 0x0FFF);
       }
-
-      ESP_LOGD(FILE_TAG, "EXA1: SKNP {%#x}", Vx);
+      check_exit_request();
     } else {
       ESP_LOGD(FILE_TAG, "Unrecognized opcode: {%#x} \n", opcode);
     }
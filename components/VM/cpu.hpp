@@ -1,52 +1,268 @@
 #ifndef CPU_HPP_
 #define CPU_HPP_
 
+extern "C" {
+#include "sdkconfig.h"
+}
 #include <array>
+#include <bitset>
 #include <cstdint>
 #include <memory>
-#include <stack>
-#include <string>
+#include <optional>
 #include <string_view>
 #include <vector>
 
+#include "call_stack.hpp"
+#include "decoder.hpp"
+#include "jit_x86_64.hpp"
 #include "keyboard.hpp"
 #include "display.hpp"
+#include "profiler.hpp"
+#include "rewind.hpp"
+#include "rng.hpp"
+#include "save_state.hpp"
+#include "trace.hpp"
+
+// How step_one_cycle() turns an opcode into work. The reference switch is
+// the original decoder and is kept around to validate and benchmark the
+// faster engines against. predecoded runs out of a cache of instructions
+// decoded once at load time. jit translates guest code to native x86-64
+// and is only available where CHIP8_HAS_JIT is defined. aot runs the C++
+// translation of the loaded ROM attached with chip8::attach_aot(). fused
+// is predecoded plus superinstructions for common opcode pairs.
+enum class dispatch_mode : uint8_t {
+  reference,
+  table,
+  predecoded,
+  jit,
+  aot,
+  fused
+};
+
+struct aot_rom;
+
+// Why run_cycles() returned before using up its budget
+enum class run_stop : uint8_t {
+  budget,   // all instructions ran
+  key_wait, // FX0A is waiting for a key press
+  exit      // the exit key was pressed
+};
+
+// Misbehaving subroutine calls since the ROM was loaded. A 2NNN with all
+// 16 return addresses in use still jumps but its return address is lost;
+// a 00EE with none left does nothing.
+struct stack_faults {
+  uint32_t overflows;
+  uint32_t underflows;
+};
+
+// Everything a debugger or frontend shows about the CPU, without copying
+// the VM: the registers and the call stack are referenced, the rest are
+// plain values. Only valid as long as the chip8 it came from.
+struct cpu_state {
+  const std::array<uint8_t, 16> &V;
+  const call_stack &stack;
+  uint16_t I;
+  uint16_t prog_counter;
+  uint8_t delay_timer;
+  uint8_t sound_timer;
+  std::size_t stack_depth;
+  uint16_t keys; // bit n set while key n is down
+};
+
+struct run_summary {
+  uint32_t cycles;      // instructions executed
+  bool display_changed; // at least one of them drew
+  bool sound_active;    // the sound timer is still running
+  run_stop reason;
+};
 
 class chip8 {
 public:
   chip8();
   explicit chip8(keyboard* keyPtr);
+  ~chip8();
+  // A VM is big and owns a JIT on some hosts, it is never copied or moved
+  chip8(const chip8 &) = delete;
+  chip8 &operator=(const chip8 &) = delete;
+  chip8(chip8 &&) = delete;
+  chip8 &operator=(chip8 &&) = delete;
   void load_memory(const std::vector<uint8_t> &rom_opcodes);
   void load_memory(std::string_view file_name);
+  // Back to the power-on state: only the font in memory, no ROM loaded
   void reset();
   void step_one_cycle();
-  [[nodiscard]] std::array<uint8_t, 16> get_V_registers() const;
+  // Execute up to cycles instructions back to back. Stops early when the
+  // program waits for a key (FX0A) or the exit key was pressed. The display
+  // flag is set if any of them drew.
+  run_summary run_cycles(uint32_t cycles);
+  // run_cycles() with the number of instructions that make up one frame,
+  // i.e. 1/60 s of emulated time. The delay and sound timers count down
+  // once per frame's worth of instructions, independent of how the VM is
+  // stepped or how fast the host runs it. A frame ended early by a key
+  // wait still counts as a whole one for the timers and the keyboard.
+  run_summary run_frame();
+  void set_cycles_per_frame(uint32_t cycles);
+  [[nodiscard]] uint32_t get_cycles_per_frame() const;
+  // The state accessors below return references into the VM or small
+  // values, so polling them every frame costs no copies
+  [[nodiscard]] cpu_state get_cpu_state() const;
+  [[nodiscard]] const std::array<uint8_t, 16> &get_V_registers() const;
+  // Bit n set while key n is down
+  [[nodiscard]] uint16_t get_pressed_keys() const;
   [[nodiscard]] std::array<bool, 16> get_Keys_array() const;
-  [[nodiscard]] std::array<uint8_t, 4096> get_memory_dump() const;
-  [[nodiscard]] const std::array<uint8_t, display_size>& get_display_pixels() const;
+  [[nodiscard]] const std::array<uint8_t, 4096> &get_memory_dump() const;
+  // One byte per pixel, unpacked from the framebuffer
+  [[nodiscard]] std::array<uint8_t, display_size> get_display_pixels() const;
+  [[nodiscard]] const display_rows &get_display_rows() const;
+  // Rows and columns drawn since the last call, for TFTDisp::drawGfx()
+  [[nodiscard]] display_damage take_display_damage();
   [[nodiscard]] uint16_t get_prog_counter() const;
   [[nodiscard]] uint8_t get_delay_counter() const;
   [[nodiscard]] uint8_t get_sound_counter() const;
   [[nodiscard]] uint16_t get_I_register() const;
-  [[nodiscard]] std::string get_instruction() const;
-  [[nodiscard]] std::stack<uint16_t> get_stack() const;
+  [[nodiscard]] const call_stack &get_stack() const;
+  [[nodiscard]] stack_faults get_stack_faults() const;
   [[nodiscard]] bool get_display_flag() const;
+  // CXNN draws from a generator that is seeded whenever a ROM is loaded,
+  // from hardware entropy unless a fixed seed is set. With a fixed seed,
+  // runs with the same input produce the same frames.
+  void set_fixed_seed(uint32_t seed);
+  void clear_fixed_seed();
+  // Snapshot of everything the running program can see, in the format of
+  // save_state.hpp. Neither direction allocates; restoring re-decodes only
+  // the memory that differs, so both are cheap enough to do every frame.
+  // The dispatch mode, fixed seed, profile and trace are not part of it.
+  void save_state(saved_state &out) const;
+  // Fails and leaves the VM untouched unless state holds a save state of
+  // this version
+  bool load_state(const uint8_t *state, std::size_t size);
+  bool load_state(const saved_state &state) {
+    return load_state(state.data(), state.size());
+  }
+  // Go back the given number of run_frame() calls, as far as the history
+  // reaches, and forget the frames after that. Returns how many frames it
+  // went back, always 0 unless the VM was built with CONFIG_CHIP8_REWIND.
+  uint32_t rewind(uint32_t frames);
+  [[nodiscard]] uint32_t get_rewind_frames() const;
+  void clear_rewind();
+  void set_dispatch_mode(dispatch_mode new_mode);
+  [[nodiscard]] dispatch_mode get_dispatch_mode() const;
+  // Use the build time translation of the loaded ROM. Blocks whose code
+  // differs from what is in memory, e.g. after a save state of a game that
+  // wrote into its ROM area was loaded, run through the interpreter. Fails
+  // only if rom does not fit in memory. Loading another ROM detaches it.
+  bool attach_aot(const aot_rom *rom);
+  // Copy of the opcode and address counters, empty unless the VM was built
+  // with CONFIG_CHIP8_PROFILER
+  void get_profile(vm_profile &snapshot) const;
+  void reset_profile();
+  // Write the trace of the last executed instructions in the format
+  // tools/chip8_trace.py reads. Fails unless the VM was built with
+  // CONFIG_CHIP8_TRACE.
+  bool write_trace(std::FILE *out) const;
+  void clear_trace();
 
 private:
+  friend class aot_runtime;
+  // The view of the VM the instruction handlers run on, see handlers.hpp
+  struct machine;
+#ifdef CHIP8_HAS_JIT
+  friend class jit_x86_64;
+  std::unique_ptr<jit_x86_64> jit;
+#endif
   std::array<uint8_t, 4096> memory{0};
+  // Decoded form of the instruction at every even address, see
+  // predecode_memory(). Odd program counters are decoded on the fly.
+  std::array<decoded_instruction, 2048> decoded_cache{};
   std::array<uint8_t, 16> V{0};
-  std::stack<uint16_t> hw_stack;
-  std::array<uint8_t, display_size> display{0};
-  keyboard* numpad;
+  call_stack hw_stack;
+  stack_faults faults{0, 0};
+  display_rows display{0};
+  display_damage damage;
+  // Without one no key is ever down
+  keyboard* numpad{nullptr};
   uint16_t I{0};
   const uint16_t prog_mem_begin = 512;
   uint16_t prog_counter{prog_mem_begin};
-  std::string instruction{""};
   uint8_t delay_timer{0};
   uint8_t sound_timer{0};
   bool isKeyBPressed{false};
   bool isDisplaySet{false};
+  dispatch_mode mode{dispatch_mode::predecoded};
+  xorshift32 rng;
+  std::optional<uint32_t> fixed_seed;
+  uint32_t cycles_per_frame;
+  // Instructions executed since the timers last counted down
+  uint32_t timer_phase{0};
+  // Set by the keypad instructions to end the current run_cycles() batch
+  run_stop stop_request{run_stop::budget};
+  const aot_rom *aot{nullptr};
+  // Start addresses of translated blocks the guest has written over
+  std::bitset<4096> aot_stale;
+#ifdef CONFIG_CHIP8_PROFILER
+  vm_profile profile;
+#endif
+  // Count the instruction at pc, compiles to nothing without the profiler
+  void profile_hit([[maybe_unused]] const uint16_t pc,
+                   [[maybe_unused]] const opcode_id id) {
+#ifdef CONFIG_CHIP8_PROFILER
+    profile.record(pc, id);
+#endif
+  }
+#ifdef CONFIG_CHIP8_TRACE
+  trace_ring<CONFIG_CHIP8_TRACE_RECORDS> trace;
+#endif
+  // Record the instruction at pc once it ran, compiles to nothing without
+  // the trace
+  void trace_step([[maybe_unused]] const uint16_t pc,
+                  [[maybe_unused]] const uint16_t opcode) {
+#ifdef CONFIG_CHIP8_TRACE
+    trace.record(pc, opcode, I, V[second_nibble(opcode) >> 8], V[0xF]);
+#endif
+  }
+#ifdef CONFIG_CHIP8_REWIND
+  rewind_ring_within<CONFIG_CHIP8_REWIND_BYTES,
+                     CONFIG_CHIP8_REWIND_KEYFRAME_INTERVAL>
+      history;
+  saved_state history_frame;
+  static_assert(sizeof(history) + sizeof(history_frame) <=
+                    CONFIG_CHIP8_REWIND_BYTES,
+                "the rewind history has to fit in CONFIG_CHIP8_REWIND_BYTES");
+#endif
+  // Keep the frame that just ended in the rewind history, compiles to
+  // nothing without it
+  void rewind_capture() {
+#ifdef CONFIG_CHIP8_REWIND
+    save_state(history_frame);
+    history.capture(history_frame);
+#endif
+  }
   void reset_internal_states();
+  void seed_rng();
+  void predecode_memory();
+  void fuse_decoded(std::size_t first, std::size_t last);
+  void invalidate_decoded(uint16_t address, uint16_t length);
+  void step_reference();
+  uint32_t step_cycles(uint32_t cycles);
+  void check_exit_request();
+  void report_stack_overflow();
+  void report_stack_underflow();
+  void clear_display();
+  uint32_t run_aot(uint32_t cycles);
+  uint32_t run_fused(uint32_t cycles);
+  uint32_t execute_fused(const decoded_instruction &first);
+  void execute(const decoded_instruction &ins);
+  void execute_opcode(uint16_t opcode);
+  // Advance emulated time by count instructions
+  void tick_timers(const uint32_t count) {
+    timer_phase += count;
+    if (timer_phase >= cycles_per_frame) {
+      expire_timer_periods();
+    }
+  }
+  void expire_timer_periods();
+
 };
 
 #endif // CPU_HPP
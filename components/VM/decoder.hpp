@@ -0,0 +1,343 @@
+#ifndef DECODER_HPP_
+#define DECODER_HPP_
+
+#include <array>
+#include <cstdint>
+#include <utility>
+
+// Mask function to get the first Nibble 0xN000
+// example: input is 0x6133, output will be 0x6000
+static constexpr uint16_t first_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0xF000U);
+}
+
+// Mask function to get the second Nibble 0x0N00
+// example: input is 0x6133, output will be 0x0100
+static constexpr uint16_t second_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x0F00U);
+}
+
+// Mask function to get the third Nibble 0x00N0
+// example: input is 0x6133, output will be 0x0030
+static constexpr uint8_t third_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x00F0U);
+}
+
+// Mask function to get the last Nibble 0x000N
+// example: input is 0x6133, output will be 0x0003
+static constexpr uint8_t last_nibble(const uint16_t opcode) noexcept {
+  return (opcode & 0x000FU);
+}
+// Mask function to get the last two nibbles 0x00NN
+// example: input is 0x6133, output will be 0x0033
+static constexpr uint8_t last_two_nibbles(const uint16_t opcode) noexcept {
+  return (opcode & 0x00FFU);
+}
+
+// Mask function to get the last three nibbles 0x0NNN
+// example: input is 0x6133, output will be 0x0133
+static constexpr uint16_t last_three_nibbles(const uint16_t opcode) noexcept {
+  return (opcode & 0x0FFFU);
+}
+// Mask function to get the last two nibbles 0x00NN
+// example: input is 0x6133, output will be 0x0100
+static constexpr std::pair<uint8_t, uint8_t>
+get_XY_nibbles(const uint16_t opcode) noexcept {
+  return {(second_nibble(opcode) >> 8), (third_nibble(opcode) >> 4)};
+}
+
+// Every instruction the VM knows about. Each id has exactly one exec_*
+// handler in handlers.hpp, and count must stay the last entry.
+enum class opcode_id : uint8_t {
+  unknown,
+  op_00E0, // CLS
+  op_00EE, // RET
+  op_1NNN, // JP NNN
+  op_2NNN, // CALL NNN
+  op_3XNN, // SE VX, NN
+  op_4XNN, // SNE VX, NN
+  op_5XY0, // SE VX, VY
+  op_6XNN, // LD VX, NN
+  op_7XNN, // ADD VX, NN
+  op_8XY0, // LD VX, VY
+  op_8XY1, // OR VX, VY
+  op_8XY2, // AND VX, VY
+  op_8XY3, // XOR VX, VY
+  op_8XY4, // ADD VX, VY
+  op_8XY5, // SUB VX, VY
+  op_8XY6, // SHR VX, VY
+  op_8XY7, // SUBN VX, VY
+  op_8XYE, // SHL VX, VY
+  op_9XY0, // SNE VX, VY
+  op_ANNN, // LD I, NNN
+  op_BNNN, // JP V0, NNN
+  op_CXNN, // RND VX, NN
+  op_DXYN, // DRW VX, VY, N
+  op_EX9E, // SKP VX
+  op_EXA1, // SKNP VX
+  op_FX07, // LD VX, DT
+  op_FX0A, // LD VX, K
+  op_FX15, // LD DT, VX
+  op_FX18, // LD ST, VX
+  op_FX1E, // ADD I, VX
+  op_FX29, // LD F, VX
+  op_FX33, // LD B, VX
+  op_FX55, // LD [I], VX
+  op_FX65, // LD VX, [I]
+  count
+};
+
+static constexpr std::size_t opcode_id_count =
+    static_cast<std::size_t>(opcode_id::count);
+
+// Printable names, indexed by opcode_id
+inline constexpr std::array<const char *, opcode_id_count> opcode_names = {
+    "unknown", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+    "6XNN",    "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5",
+    "8XY6",    "8XY7", "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN",
+    "EX9E",    "EXA1", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29",
+    "FX33",    "FX55", "FX65"};
+
+// Superinstructions: an instruction together with the one following it in
+// memory, executed in a single dispatch by dispatch_mode::fused. The pairs
+// are the most frequent fall-through pairs reported by host/chip8_pairs on
+// the bundled ROMs.
+enum class fused_id : uint8_t {
+  none,
+  op_ANNN_DXYN, // sprite address + draw
+  op_ANNN_FX1E, // table base + index
+  op_DXYN_3XNN, // draw + collision check
+  op_DXYN_7XNN, // draw + advance position
+  op_FX07_3XNN, // delay timer wait loop
+  op_7XNN_3XNN, // loop counter, exit when equal
+  op_7XNN_4XNN, // loop counter, exit when different
+  op_7XNN_7XNN, // two adds
+  op_3XNN_1NNN, // loop condition + back edge
+  op_4XNN_1NNN, // loop condition + back edge
+};
+
+// A decoded instruction: which handler to run plus all the operand
+// fields already masked out of the opcode, so handlers never touch
+// the raw 16-bit value again. fused is filled in by chip8 once the
+// following instruction is known.
+struct decoded_instruction {
+  opcode_id id;
+  uint8_t x;
+  uint8_t y;
+  uint8_t n;
+  uint8_t nn;
+  fused_id fused;
+  uint16_t nnn;
+};
+
+// Classify one opcode. This mirrors the reference switch in
+// chip8::step_reference() exactly, including the opcodes it ignores
+// (e.g. 5XY1 behaves as 5XY0 because the last nibble is never checked).
+static constexpr opcode_id classify(const uint16_t opcode) noexcept {
+  switch (first_nibble(opcode)) {
+  case 0x0000:
+    if (last_two_nibbles(opcode) == 0xEE) {
+      return opcode_id::op_00EE;
+    }
+    if (last_two_nibbles(opcode) == 0xE0) {
+      return opcode_id::op_00E0;
+    }
+    return opcode_id::unknown;
+  case 0x1000:
+    return opcode_id::op_1NNN;
+  case 0x2000:
+    return opcode_id::op_2NNN;
+  case 0x3000:
+    return opcode_id::op_3XNN;
+  case 0x4000:
+    return opcode_id::op_4XNN;
+  case 0x5000:
+    return opcode_id::op_5XY0;
+  case 0x6000:
+    return opcode_id::op_6XNN;
+  case 0x7000:
+    return opcode_id::op_7XNN;
+  case 0x8000:
+    switch (last_nibble(opcode)) {
+    case 0x0:
+      return opcode_id::op_8XY0;
+    case 0x1:
+      return opcode_id::op_8XY1;
+    case 0x2:
+      return opcode_id::op_8XY2;
+    case 0x3:
+      return opcode_id::op_8XY3;
+    case 0x4:
+      return opcode_id::op_8XY4;
+    case 0x5:
+      return opcode_id::op_8XY5;
+    case 0x6:
+      return opcode_id::op_8XY6;
+    case 0x7:
+      return opcode_id::op_8XY7;
+    case 0xE:
+      return opcode_id::op_8XYE;
+    default:
+      return opcode_id::unknown;
+    }
+  case 0x9000:
+    return opcode_id::op_9XY0;
+  case 0xA000:
+    return opcode_id::op_ANNN;
+  case 0xB000:
+    return opcode_id::op_BNNN;
+  case 0xC000:
+    return opcode_id::op_CXNN;
+  case 0xD000:
+    return opcode_id::op_DXYN;
+  case 0xE000:
+    if (last_two_nibbles(opcode) == 0x9E) {
+      return opcode_id::op_EX9E;
+    }
+    if (last_two_nibbles(opcode) == 0xA1) {
+      return opcode_id::op_EXA1;
+    }
+    return opcode_id::unknown;
+  default: // 0xF000
+    switch (last_two_nibbles(opcode)) {
+    case 0x07:
+      return opcode_id::op_FX07;
+    case 0x0A:
+      return opcode_id::op_FX0A;
+    case 0x15:
+      return opcode_id::op_FX15;
+    case 0x18:
+      return opcode_id::op_FX18;
+    case 0x1E:
+      return opcode_id::op_FX1E;
+    case 0x29:
+      return opcode_id::op_FX29;
+    case 0x33:
+      return opcode_id::op_FX33;
+    case 0x55:
+      return opcode_id::op_FX55;
+    case 0x65:
+      return opcode_id::op_FX65;
+    default:
+      return opcode_id::unknown;
+    }
+  }
+}
+
+// Bits below the leading nibble that tell the instructions of a group
+// apart: the last nibble for 8XY_, the low byte for 0___, E___ and F___
+// and none for the groups that hold a single instruction
+static constexpr uint16_t decode_group_mask(const uint16_t group) noexcept {
+  switch (group) {
+  case 0x0:
+  case 0xE:
+  case 0xF:
+    return 0x00FFU;
+  case 0x8:
+    return 0x000FU;
+  default:
+    return 0x0000U;
+  }
+}
+
+// Where the ids of one leading nibble start in decode_leaves
+struct decode_group {
+  uint16_t base;
+  uint16_t mask;
+};
+
+static constexpr std::array<decode_group, 16> build_decode_groups() noexcept {
+  std::array<decode_group, 16> groups{};
+  uint16_t base = 0;
+  for (uint16_t group = 0; group < groups.size(); ++group) {
+    groups[group] = {base, decode_group_mask(group)};
+    base = static_cast<uint16_t>(base + decode_group_mask(group) + 1U);
+  }
+  return groups;
+}
+
+inline constexpr std::array<decode_group, 16> decode_groups =
+    build_decode_groups();
+
+static constexpr std::size_t decode_leaf_count =
+    decode_groups[0xF].base + decode_groups[0xF].mask + 1U;
+
+static constexpr std::array<opcode_id, decode_leaf_count>
+build_decode_leaves() noexcept {
+  std::array<opcode_id, decode_leaf_count> leaves{};
+  for (uint16_t group = 0; group < decode_groups.size(); ++group) {
+    for (uint16_t low = 0; low <= decode_groups[group].mask; ++low) {
+      leaves[decode_groups[group].base + low] =
+          classify(static_cast<uint16_t>((group << 12) | low));
+    }
+  }
+  return leaves;
+}
+
+// Two level decode table built at compile time: the leading nibble picks
+// a group, the bits in its mask pick the id. 64 bytes of groups and 796
+// ids instead of one id for every 16-bit opcode.
+inline constexpr std::array<opcode_id, decode_leaf_count> decode_leaves =
+    build_decode_leaves();
+
+static constexpr opcode_id lookup_id(const uint16_t opcode) noexcept {
+  const decode_group &group = decode_groups[opcode >> 12];
+  return decode_leaves[group.base + (opcode & group.mask)];
+}
+
+static constexpr decoded_instruction decode(const uint16_t opcode) noexcept {
+  return {lookup_id(opcode),
+          static_cast<uint8_t>(second_nibble(opcode) >> 8),
+          static_cast<uint8_t>(third_nibble(opcode) >> 4),
+          last_nibble(opcode),
+          last_two_nibbles(opcode),
+          fused_id::none,
+          last_three_nibbles(opcode)};
+}
+
+// Superinstruction for first followed by second, if there is one
+static constexpr fused_id fuse(const opcode_id first,
+                               const opcode_id second) noexcept {
+  switch (first) {
+  case opcode_id::op_ANNN:
+    if (second == opcode_id::op_DXYN) {
+      return fused_id::op_ANNN_DXYN;
+    }
+    if (second == opcode_id::op_FX1E) {
+      return fused_id::op_ANNN_FX1E;
+    }
+    return fused_id::none;
+  case opcode_id::op_DXYN:
+    if (second == opcode_id::op_3XNN) {
+      return fused_id::op_DXYN_3XNN;
+    }
+    if (second == opcode_id::op_7XNN) {
+      return fused_id::op_DXYN_7XNN;
+    }
+    return fused_id::none;
+  case opcode_id::op_FX07:
+    return (second == opcode_id::op_3XNN) ? fused_id::op_FX07_3XNN
+                                          : fused_id::none;
+  case opcode_id::op_7XNN:
+    if (second == opcode_id::op_3XNN) {
+      return fused_id::op_7XNN_3XNN;
+    }
+    if (second == opcode_id::op_4XNN) {
+      return fused_id::op_7XNN_4XNN;
+    }
+    if (second == opcode_id::op_7XNN) {
+      return fused_id::op_7XNN_7XNN;
+    }
+    return fused_id::none;
+  case opcode_id::op_3XNN:
+    return (second == opcode_id::op_1NNN) ? fused_id::op_3XNN_1NNN
+                                          : fused_id::none;
+  case opcode_id::op_4XNN:
+    return (second == opcode_id::op_1NNN) ? fused_id::op_4XNN_1NNN
+                                          : fused_id::none;
+  default:
+    return fused_id::none;
+  }
+}
+
+#endif // DECODER_HPP_
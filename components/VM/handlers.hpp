@@ -0,0 +1,441 @@
+#ifndef HANDLERS_HPP_
+#define HANDLERS_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include "decoder.hpp"
+#include "display.hpp"
+#include "keyboard.hpp"
+
+// What every instruction does. A handler works on a Machine, a small view
+// of the VM's state (chip8::machine in cpu.cpp) that provides
+//   uint8_t &v(uint8_t index), uint16_t &i(), uint16_t &pc(),
+//   uint8_t &delay(), uint8_t &sound(),
+//   uint8_t read(uint16_t address), void write(uint16_t address, uint8_t),
+//   void stored(uint16_t address, uint16_t length) after an instruction
+//     wrote guest memory,
+//   bool push(uint16_t), bool pop(uint16_t &), void stack_overflow(),
+//   void stack_underflow(),
+//   display_rows &rows(), void clear_display(),
+//   void drew(uint32_t rows, uint8_t first column, uint8_t last column),
+//   uint8_t random_byte(), keyboard *keys(), void key_wait(),
+//   void check_exit(), void unknown()
+// The program counter has already moved past the instruction. Guest
+// memory is addressed modulo 4 KB.
+
+// OPCODE 00E0 : Clear display
+template <typename Machine>
+void exec_00E0(Machine &m, const decoded_instruction & /*ins*/) {
+  m.clear_display();
+}
+
+// OPCODE 00EE : Return from a subroutine
+template <typename Machine>
+void exec_00EE(Machine &m, const decoded_instruction & /*ins*/) {
+  if (!m.pop(m.pc())) {
+    m.stack_underflow();
+  }
+}
+
+// OPCODE 1NNN : Jump to address NNN
+template <typename Machine>
+void exec_1NNN(Machine &m, const decoded_instruction &ins) {
+  m.pc() = ins.nnn;
+}
+
+// OPCODE 2NNN : Execute subroutine starting at address NNN
+template <typename Machine>
+void exec_2NNN(Machine &m, const decoded_instruction &ins) {
+  if (!m.push(m.pc())) {
+    m.stack_overflow();
+  }
+  m.pc() = ins.nnn;
+}
+
+// OPCODE 3XNN : Skip the following instruction
+// if the value of register VX equals NN
+template <typename Machine>
+void exec_3XNN(Machine &m, const decoded_instruction &ins) {
+  if (m.v(ins.x) == ins.nn) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+}
+
+// OPCODE 4XNN : Skip the following instruction
+// if the value of register VX not equal to NN
+template <typename Machine>
+void exec_4XNN(Machine &m, const decoded_instruction &ins) {
+  if (m.v(ins.x) != ins.nn) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+}
+
+// OPCODE 5XY0 : Skip the following instruction if the value
+// of register VX is equal to the value of register VY
+template <typename Machine>
+void exec_5XY0(Machine &m, const decoded_instruction &ins) {
+  if (m.v(ins.x) == m.v(ins.y)) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+}
+
+// OPCODE 6XNN: Store number NN in register VX
+template <typename Machine>
+void exec_6XNN(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = ins.nn;
+}
+
+// OPCODE 7XNN : Add NN to register VX, wrapping around at 8 bits
+template <typename Machine>
+void exec_7XNN(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = static_cast<uint8_t>(m.v(ins.x) + ins.nn);
+}
+
+// OPCODE 8XY0 : Store the value of register VY in register VX
+template <typename Machine>
+void exec_8XY0(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = m.v(ins.y);
+}
+
+// OPCODE 8XY1 : Set VX to VX OR VY
+template <typename Machine>
+void exec_8XY1(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = m.v(ins.x) | m.v(ins.y);
+}
+
+// OPCODE 8XY2 : Set VX to VX AND VY
+template <typename Machine>
+void exec_8XY2(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = m.v(ins.x) & m.v(ins.y);
+}
+
+// OPCODE 8XY3 : Set VX to VX XOR VY
+template <typename Machine>
+void exec_8XY3(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = m.v(ins.x) ^ m.v(ins.y);
+}
+
+// OPCODE 8XY4 : Add the value of register VY to register VX
+// Set VF to 01 if a carry occurs else to 0
+template <typename Machine>
+void exec_8XY4(Machine &m, const decoded_instruction &ins) {
+  const auto sum = static_cast<uint16_t>(m.v(ins.y) + m.v(ins.x));
+  m.v(0xF) = static_cast<uint8_t>((sum & 0x100) >> 8);
+  m.v(ins.x) = static_cast<uint8_t>(sum);
+}
+
+// OPCODE 8XY5 : Subtract the value of register VY from register VX
+// Set VF to 01 if a borrow does not occur, else to 0
+template <typename Machine>
+void exec_8XY5(Machine &m, const decoded_instruction &ins) {
+  m.v(0xF) = (m.v(ins.x) > m.v(ins.y)) ? 1 : 0;
+  m.v(ins.x) = static_cast<uint8_t>(m.v(ins.x) - m.v(ins.y));
+}
+
+// OPCODE 8XY6 : Store the value of register VY shifted right one bit in
+// register VX. Set register VF to the least significant bit prior to the
+// shift. Vy is first changed and then it is stored in Vx
+template <typename Machine>
+void exec_8XY6(Machine &m, const decoded_instruction &ins) {
+  m.v(0xF) = m.v(ins.y) & 0x01;
+  m.v(ins.y) = static_cast<uint8_t>(m.v(ins.y) >> 1);
+  m.v(ins.x) = m.v(ins.y);
+}
+
+// OPCODE 8XY7 : Set register VX to the value of VY minus VX
+// Set VF to 01 if a borrow does not occur, else to 0
+template <typename Machine>
+void exec_8XY7(Machine &m, const decoded_instruction &ins) {
+  m.v(0xF) = (m.v(ins.y) > m.v(ins.x)) ? 1 : 0;
+  m.v(ins.x) = static_cast<uint8_t>(m.v(ins.y) - m.v(ins.x));
+}
+
+// OPCODE 8XYE : Store the value of register VY shifted left one bit in
+// register VX. Set register VF to the most significant bit prior to the
+// shift. Vy is first changed and then it is stored in Vx
+template <typename Machine>
+void exec_8XYE(Machine &m, const decoded_instruction &ins) {
+  m.v(0xF) = static_cast<uint8_t>((m.v(ins.y) & 0x80) >> 7);
+  m.v(ins.y) = static_cast<uint8_t>(m.v(ins.y) << 1);
+  m.v(ins.x) = m.v(ins.y);
+}
+
+// OPCODE 9XY0 : Skip the following instruction if the value
+// of register VX is not equal to the value of register VY
+template <typename Machine>
+void exec_9XY0(Machine &m, const decoded_instruction &ins) {
+  if (m.v(ins.x) != m.v(ins.y)) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+}
+
+// OPCODE ANNN: Store memory address NNN in register I
+template <typename Machine>
+void exec_ANNN(Machine &m, const decoded_instruction &ins) {
+  m.i() = ins.nnn;
+}
+
+// OPCODE BNNN : Jump to address NNN + V0
+template <typename Machine>
+void exec_BNNN(Machine &m, const decoded_instruction &ins) {
+  m.pc() = static_cast<uint16_t>(ins.nnn + m.v(0)) & 0x0FFF;
+}
+
+// OPCODE CXNN : Set VX to a random number with a mask of NN
+template <typename Machine>
+void exec_CXNN(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = static_cast<uint8_t>(m.random_byte() & ins.nn);
+}
+
+// OPCODE DXYN: Draw a sprite at position VX, VY with N bytes
+// of sprite data starting at the address stored in I
+// Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
+// The start position wraps around the screen, the sprite itself is clipped
+// at the right and bottom edges. Every sprite byte is shifted into place
+// and XORed into its row with a single 64-bit operation.
+template <typename Machine>
+void exec_DXYN(Machine &m, const decoded_instruction &ins) {
+  const auto x = static_cast<uint8_t>(m.v(ins.x) % display_x);
+  const auto y = static_cast<uint8_t>(m.v(ins.y) % display_y);
+  display_rows &rows = m.rows();
+
+  uint64_t collision = 0;
+  uint8_t row = 0;
+  for (; (row < ins.n) && ((y + row) < display_y); row++) {
+    const uint64_t sprite =
+        (uint64_t{m.read(static_cast<uint16_t>((m.i() + row) & 0x0FFFU))}
+         << (display_x - 8)) >>
+        x;
+    collision |= rows[y + row] & sprite;
+    rows[y + row] ^= sprite;
+  }
+  m.v(0xF) = (collision != 0) ? 1 : 0;
+  m.drew(((uint32_t{1} << row) - 1U) << y, x,
+         static_cast<uint8_t>(std::min(x + 7, display_x - 1)));
+}
+
+// OPCODE EX9E:	Skip the following instruction if the key
+// corresponding to the hex value currently stored in register VX is pressed
+template <typename Machine>
+void exec_EX9E(Machine &m, const decoded_instruction &ins) {
+  keyboard *const keys = m.keys();
+  if (keys && keys->isKeyVxPressed(m.v(ins.x))) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+  m.check_exit();
+}
+
+// OPCODE EXA1: Skip the following instruction if the key corresponding
+// to the hex value currently stored in register VX is not pressed
+template <typename Machine>
+void exec_EXA1(Machine &m, const decoded_instruction &ins) {
+  keyboard *const keys = m.keys();
+  if (!keys || !keys->isKeyVxPressed(m.v(ins.x))) {
+    m.pc() = static_cast<uint16_t>(m.pc() + 2) & 0x0FFF;
+  }
+  m.check_exit();
+}
+
+// OPCODE FX07: Store the current value of the delay timer in register VX
+template <typename Machine>
+void exec_FX07(Machine &m, const decoded_instruction &ins) {
+  m.v(ins.x) = m.delay();
+}
+
+// OPCODE FX0A: Wait for a keypress and store the result in register VX
+template <typename Machine>
+void exec_FX0A(Machine &m, const decoded_instruction &ins) {
+  keyboard *const keys = m.keys();
+  const std::optional<uint8_t> index =
+      keys ? keys->whichKeyIndexIfPressed() : std::nullopt;
+  if (index) {
+    m.v(ins.x) = *index;
+  } else {
+    // reset the counter to repeat this opcode until key is pressed
+    m.pc() = static_cast<uint16_t>(m.pc() - 2) & 0x0FFF;
+    m.key_wait();
+  }
+  m.check_exit();
+}
+
+// OPCODE FX15:	Set the delay timer to the value of register VX
+template <typename Machine>
+void exec_FX15(Machine &m, const decoded_instruction &ins) {
+  m.delay() = m.v(ins.x);
+}
+
+// OPCODE FX18: Set the sound timer to the value of register VX
+template <typename Machine>
+void exec_FX18(Machine &m, const decoded_instruction &ins) {
+  m.sound() = m.v(ins.x);
+}
+
+// OPCODE FX1E: Add the value stored in register VX to register I
+template <typename Machine>
+void exec_FX1E(Machine &m, const decoded_instruction &ins) {
+  m.i() = static_cast<uint16_t>(m.i() + m.v(ins.x));
+}
+
+// OPCODE FX29: Set I to the memory address of the sprite data
+// corresponding to the hexadecimal digit stored in register VX
+template <typename Machine>
+void exec_FX29(Machine &m, const decoded_instruction &ins) {
+  m.i() = static_cast<uint16_t>(5 * m.v(ins.x));
+}
+
+// OPCODE FX33: Store the binary-coded decimal equivalent of
+// the value stored in register VX at addresses I, I+1, and I+2
+template <typename Machine>
+void exec_FX33(Machine &m, const decoded_instruction &ins) {
+  const uint8_t value = m.v(ins.x);
+  const uint16_t at = m.i();
+  m.write(static_cast<uint16_t>(at & 0x0FFFU),
+          static_cast<uint8_t>(value / 100));
+  m.write(static_cast<uint16_t>((at + 1U) & 0x0FFFU),
+          static_cast<uint8_t>((value / 10) % 10));
+  m.write(static_cast<uint16_t>((at + 2U) & 0x0FFFU),
+          static_cast<uint8_t>(value % 10));
+  m.stored(static_cast<uint16_t>(at & 0x0FFFU), 3);
+}
+
+// OPCODE FX55: Store the values of registers V0 to VX
+// inclusive in memory starting at address I
+// I is set to I + X + 1 after operation
+template <typename Machine>
+void exec_FX55(Machine &m, const decoded_instruction &ins) {
+  const uint16_t at = m.i();
+  for (uint8_t i = 0; i <= ins.x; ++i) {
+    m.write(static_cast<uint16_t>((at + i) & 0x0FFFU), m.v(i));
+  }
+  m.stored(static_cast<uint16_t>(at & 0x0FFFU),
+           static_cast<uint16_t>(ins.x + 1));
+  m.i() = static_cast<uint16_t>(at + ins.x + 1);
+}
+
+// OPCODE FX65: Fill registers V0 to VX
+// inclusive with the values stored in memory starting at address I
+// I is set to I + X + 1 after operation
+template <typename Machine>
+void exec_FX65(Machine &m, const decoded_instruction &ins) {
+  const uint16_t at = m.i();
+  for (uint8_t i = 0; i <= ins.x; ++i) {
+    m.v(i) = m.read(static_cast<uint16_t>((at + i) & 0x0FFFU));
+  }
+  m.i() = static_cast<uint16_t>(at + ins.x + 1);
+}
+
+// Run one decoded instruction on m
+template <typename Machine>
+void execute_on(Machine &m, const decoded_instruction &ins) {
+  switch (ins.id) {
+  case opcode_id::op_00E0:
+    exec_00E0(m, ins);
+    break;
+  case opcode_id::op_00EE:
+    exec_00EE(m, ins);
+    break;
+  case opcode_id::op_1NNN:
+    exec_1NNN(m, ins);
+    break;
+  case opcode_id::op_2NNN:
+    exec_2NNN(m, ins);
+    break;
+  case opcode_id::op_3XNN:
+    exec_3XNN(m, ins);
+    break;
+  case opcode_id::op_4XNN:
+    exec_4XNN(m, ins);
+    break;
+  case opcode_id::op_5XY0:
+    exec_5XY0(m, ins);
+    break;
+  case opcode_id::op_6XNN:
+    exec_6XNN(m, ins);
+    break;
+  case opcode_id::op_7XNN:
+    exec_7XNN(m, ins);
+    break;
+  case opcode_id::op_8XY0:
+    exec_8XY0(m, ins);
+    break;
+  case opcode_id::op_8XY1:
+    exec_8XY1(m, ins);
+    break;
+  case opcode_id::op_8XY2:
+    exec_8XY2(m, ins);
+    break;
+  case opcode_id::op_8XY3:
+    exec_8XY3(m, ins);
+    break;
+  case opcode_id::op_8XY4:
+    exec_8XY4(m, ins);
+    break;
+  case opcode_id::op_8XY5:
+    exec_8XY5(m, ins);
+    break;
+  case opcode_id::op_8XY6:
+    exec_8XY6(m, ins);
+    break;
+  case opcode_id::op_8XY7:
+    exec_8XY7(m, ins);
+    break;
+  case opcode_id::op_8XYE:
+    exec_8XYE(m, ins);
+    break;
+  case opcode_id::op_9XY0:
+    exec_9XY0(m, ins);
+    break;
+  case opcode_id::op_ANNN:
+    exec_ANNN(m, ins);
+    break;
+  case opcode_id::op_BNNN:
+    exec_BNNN(m, ins);
+    break;
+  case opcode_id::op_CXNN:
+    exec_CXNN(m, ins);
+    break;
+  case opcode_id::op_DXYN:
+    exec_DXYN(m, ins);
+    break;
+  case opcode_id::op_EX9E:
+    exec_EX9E(m, ins);
+    break;
+  case opcode_id::op_EXA1:
+    exec_EXA1(m, ins);
+    break;
+  case opcode_id::op_FX07:
+    exec_FX07(m, ins);
+    break;
+  case opcode_id::op_FX0A:
+    exec_FX0A(m, ins);
+    break;
+  case opcode_id::op_FX15:
+    exec_FX15(m, ins);
+    break;
+  case opcode_id::op_FX18:
+    exec_FX18(m, ins);
+    break;
+  case opcode_id::op_FX1E:
+    exec_FX1E(m, ins);
+    break;
+  case opcode_id::op_FX29:
+    exec_FX29(m, ins);
+    break;
+  case opcode_id::op_FX33:
+    exec_FX33(m, ins);
+    break;
+  case opcode_id::op_FX55:
+    exec_FX55(m, ins);
+    break;
+  case opcode_id::op_FX65:
+    exec_FX65(m, ins);
+    break;
+  default:
+    m.unknown();
+    break;
+  }
+}
+
+#endif // HANDLERS_HPP_
@@ -0,0 +1,495 @@
+#include "jit_x86_64.hpp"
+
+#ifdef CHIP8_HAS_JIT
+
+extern "C" {
+#include "esp_log.h"
+}
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpu.hpp"
+
+// static defines
+static constexpr const char *FILE_TAG = "JIT";
+
+// Upper bound of the machine code emitted for one guest instruction,
+// including the exits of a block terminator
+static constexpr std::size_t max_instruction_bytes = 160;
+
+// Register usage of the generated code:
+//   r12 : chip8 *vm, every guest register is addressed as [r12 + disp32]
+//   r13 : jit_x86_64::frame *, the remaining cycle budget lives at [r13]
+//   eax, ecx, edx : scratch
+static constexpr uint8_t reg_eax = 0;
+static constexpr uint8_t reg_ecx = 1;
+static constexpr uint8_t reg_edx = 2;
+
+// Opcodes that poll the keyboard are never translated. A block ends right
+// before them and the dispatcher runs them through the interpreter.
+static constexpr bool is_interpreted(const opcode_id id) {
+  return (id == opcode_id::op_FX0A) || (id == opcode_id::op_EX9E) ||
+         (id == opcode_id::op_EXA1);
+}
+
+jit_x86_64::jit_x86_64() {
+  void *buffer = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    ESP_LOGE(FILE_TAG, "Could not map %zu bytes for generated code",
+             code_buffer_size);
+    return;
+  }
+  code_buffer = static_cast<uint8_t *>(buffer);
+  emit_stubs();
+  set_writable(false);
+}
+
+jit_x86_64::~jit_x86_64() {
+  if (code_buffer) {
+    munmap(code_buffer, code_buffer_size);
+  }
+}
+
+bool jit_x86_64::ready() const { return code_buffer != nullptr; }
+
+// The code buffer is never writable and executable at the same time. It
+// is only written while run() is outside the generated code, so it
+// switches to writable for a compile and back to executable afterwards.
+void jit_x86_64::set_writable(const bool writable) {
+  const int protection =
+      writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC);
+  if (mprotect(code_buffer, code_buffer_size, protection) != 0) {
+    ESP_LOGE(FILE_TAG, "Could not make the generated code %s",
+             writable ? "writable" : "executable");
+    abort();
+  }
+}
+
+void jit_x86_64::execute_helper(chip8 *vm, const uint32_t opcode) {
+  vm->execute_opcode(static_cast<uint16_t>(opcode));
+}
+
+void jit_x86_64::timer_helper(chip8 *vm) { vm->expire_timer_periods(); }
+
+std::ptrdiff_t jit_x86_64::offset_of(const chip8 &vm, const void *field) {
+  return static_cast<const uint8_t *>(field) -
+         reinterpret_cast<const uint8_t *>(&vm);
+}
+
+uint32_t jit_x86_64::run(chip8 &vm, const uint32_t cycles) {
+  frame frm{cycles};
+  bool drawn = false;
+
+  while ((frm.budget > 0) && (vm.stop_request == run_stop::budget)) {
+    if (flush_pending) {
+      invalidate_all();
+    }
+    const uint16_t pc = vm.prog_counter;
+    const block_info *blk = nullptr;
+    if (pc < (vm.memory.size() - 1)) {
+      blk = blocks[pc].code ? &blocks[pc] : compile(vm, pc);
+    }
+    if (!blk || (blk->length > frm.budget)) {
+      vm.step_one_cycle();
+      drawn = drawn || vm.isDisplaySet;
+      --frm.budget;
+      continue;
+    }
+    vm.isDisplaySet = false;
+    enter(&vm, &frm, blk->code);
+    drawn = drawn || vm.isDisplaySet;
+  }
+  vm.isDisplaySet = drawn;
+  return cycles - frm.budget;
+}
+
+void jit_x86_64::invalidate(const uint16_t address, const uint16_t length) {
+  const std::size_t end =
+      std::min<std::size_t>(address + length, code_bytes.size());
+  for (std::size_t i = address; i < end; ++i) {
+    if (code_bytes[i]) {
+      // The block doing the write may still be running, so only mark the
+      // cache stale here. run() flushes it once control is back.
+      flush_pending = true;
+      return;
+    }
+  }
+}
+
+void jit_x86_64::invalidate_all() {
+  blocks.fill({});
+  code_bytes.reset();
+  pending_count = 0;
+  flush_pending = false;
+  if (code_buffer) {
+    set_writable(true);
+    code_size = 0;
+    emit_stubs();
+    set_writable(false);
+  }
+}
+
+void jit_x86_64::emit8(const uint8_t byte) { code_buffer[code_size++] = byte; }
+
+void jit_x86_64::emit16(const uint16_t value) {
+  std::memcpy(code_buffer + code_size, &value, sizeof(value));
+  code_size += sizeof(value);
+}
+
+void jit_x86_64::emit32(const uint32_t value) {
+  std::memcpy(code_buffer + code_size, &value, sizeof(value));
+  code_size += sizeof(value);
+}
+
+void jit_x86_64::emit64(const uint64_t value) {
+  std::memcpy(code_buffer + code_size, &value, sizeof(value));
+  code_size += sizeof(value);
+}
+
+// Emit "<opcode> reg, [r12 + offset]". r12 as a base register always
+// needs a SIB byte, and guest state sits further than a disp8 away.
+void jit_x86_64::emit_mem(const std::initializer_list<uint8_t> opcode,
+                          const uint8_t reg, const std::ptrdiff_t offset) {
+  emit8(0x41); // REX.B selects r12
+  for (const auto byte : opcode) {
+    emit8(byte);
+  }
+  emit8(static_cast<uint8_t>(0x84 | (reg << 3))); // mod=10 rm=SIB
+  emit8(0x24);                                    // base=r12, no index
+  emit32(static_cast<uint32_t>(offset));
+}
+
+void jit_x86_64::patch_jump(const std::size_t patch_offset,
+                            const uint8_t *target) {
+  const auto rel = static_cast<int32_t>(
+      target - (code_buffer + patch_offset + sizeof(int32_t)));
+  std::memcpy(code_buffer + patch_offset, &rel, sizeof(rel));
+}
+
+// Two fixed stubs at the start of the buffer:
+//   enter(vm, frame, block) saves the callee-saved registers it uses and
+//   jumps into the block, and the epilogue every block exit leads to
+//   restores them and returns to run().
+void jit_x86_64::emit_stubs() {
+  enter = reinterpret_cast<entry_fn>(code_buffer + code_size);
+  emit8(0x53);               // push rbx (keeps the stack 16-byte aligned)
+  emit8(0x41), emit8(0x54);  // push r12
+  emit8(0x41), emit8(0x55);  // push r13
+  emit8(0x49), emit8(0x89), emit8(0xFC); // mov r12, rdi
+  emit8(0x49), emit8(0x89), emit8(0xF5); // mov r13, rsi
+  emit8(0xFF), emit8(0xE2);  // jmp rdx
+
+  epilogue_offset = code_size;
+  emit8(0x41), emit8(0x5D); // pop r13
+  emit8(0x41), emit8(0x5C); // pop r12
+  emit8(0x5B);              // pop rbx
+  emit8(0xC3);              // ret
+}
+
+// Emulated time advances by one instruction per instruction, and the
+// timers count down whenever it crosses a frame boundary. Instead of doing
+// that after every instruction, a block batches the time and only catches
+// up right before something reads or writes a timer, and at its exits.
+// Only the rare frame boundary calls back into the VM.
+void jit_x86_64::emit_timer_ticks(const chip8 &vm, const uint32_t up_to) {
+  const uint32_t ticks = up_to - ticks_emitted;
+  if (ticks == 0) {
+    return;
+  }
+  const auto phase = offset_of(vm, &vm.timer_phase);
+  const auto period = offset_of(vm, &vm.cycles_per_frame);
+  emit_mem({0x8B}, reg_eax, phase);  // mov eax, phase
+  emit8(0x83), emit8(0xC0);          // add eax, ticks
+  emit8(static_cast<uint8_t>(ticks));
+  emit_mem({0x89}, reg_eax, phase);  // mov phase, eax
+  emit_mem({0x3B}, reg_eax, period); // cmp eax, cycles_per_frame
+  emit8(0x72), emit8(15);            // jb past the call
+  emit8(0x4C), emit8(0x89), emit8(0xE7); // mov rdi, r12
+  emit8(0x48), emit8(0xB8);              // movabs rax, timer_helper
+  emit64(reinterpret_cast<uint64_t>(&jit_x86_64::timer_helper));
+  emit8(0xFF), emit8(0xD0); // call rax
+  ticks_emitted = up_to;
+}
+
+// Leave the block with the guest program counter set to target_pc. When
+// chain is set the jump is later patched to go straight into the block at
+// target_pc instead of returning to run().
+void jit_x86_64::emit_exit(const uint16_t target_pc, bool chain) {
+  chain = chain && (target_pc < (blocks.size() - 1));
+  emit8(0x66);
+  emit_mem({0xC7}, 0, pc_offset); // mov word [prog_counter], target_pc
+  emit16(target_pc);
+  emit8(0xE9); // jmp rel32
+  const std::size_t patch_offset = code_size;
+  emit32(0);
+  if (chain && blocks[target_pc].code) {
+    patch_jump(patch_offset, blocks[target_pc].code);
+  } else {
+    patch_jump(patch_offset, code_buffer + epilogue_offset);
+    if (chain && (pending_count < pending_links.size())) {
+      pending_links[pending_count++] = {patch_offset, target_pc};
+    }
+  }
+}
+
+// Run one instruction through chip8::execute_opcode(). The program counter
+// is stored first since CALL pushes it and RET/BNNN overwrite it.
+void jit_x86_64::emit_call_helper(const uint16_t opcode,
+                                  const uint16_t next_pc) {
+  emit8(0x66);
+  emit_mem({0xC7}, 0, pc_offset); // mov word [prog_counter], next_pc
+  emit16(next_pc);
+  emit8(0x4C), emit8(0x89), emit8(0xE7); // mov rdi, r12
+  emit8(0xBE);                           // mov esi, opcode
+  emit32(opcode);
+  emit8(0x48), emit8(0xB8); // movabs rax, execute_helper
+  emit64(reinterpret_cast<uint64_t>(&jit_x86_64::execute_helper));
+  emit8(0xFF), emit8(0xD0); // call rax
+}
+
+const jit_x86_64::block_info *jit_x86_64::compile(chip8 &vm,
+                                                  const uint16_t start_pc) {
+  const uint16_t first_opcode = static_cast<uint16_t>(
+      (vm.memory[start_pc] << 8) | vm.memory[start_pc + 1U]);
+  if (is_interpreted(decode(first_opcode).id)) {
+    return nullptr;
+  }
+  if ((code_buffer_size - code_size) <
+      (max_block_length + 2U) * max_instruction_bytes) {
+    invalidate_all();
+  }
+  set_writable(true);
+  pc_offset = offset_of(vm, &vm.prog_counter);
+  const auto V_offset = [&vm](const uint8_t reg) {
+    return offset_of(vm, &vm.V[reg]);
+  };
+  const auto I_offset = offset_of(vm, &vm.I);
+  const auto VF_offset = V_offset(0xF);
+
+  // Prologue: bail out to run() if the remaining budget cannot cover the
+  // whole block. The block length is patched in once it is known.
+  uint8_t *const entry = code_buffer + code_size;
+  emit8(0x41), emit8(0x81), emit8(0x7D), emit8(0x00); // cmp dword [r13], n
+  const std::size_t cmp_length_offset = code_size;
+  emit32(0);
+  emit8(0x0F), emit8(0x82); // jb epilogue
+  emit32(0);
+  patch_jump(code_size - sizeof(int32_t), code_buffer + epilogue_offset);
+  emit8(0x41), emit8(0x81), emit8(0x6D), emit8(0x00); // sub dword [r13], n
+  const std::size_t sub_length_offset = code_size;
+  emit32(0);
+
+  ticks_emitted = 0;
+  uint16_t pc = start_pc;
+  uint32_t length = 0;
+  bool open = true;
+  while (open) {
+    if ((pc >= (vm.memory.size() - 1)) || (length == max_block_length)) {
+      emit_timer_ticks(vm, length);
+      emit_exit(pc, true);
+      break;
+    }
+    const auto opcode =
+        static_cast<uint16_t>((vm.memory[pc] << 8) | vm.memory[pc + 1U]);
+    const auto ins = decode(opcode);
+    if (is_interpreted(ins.id)) {
+      emit_timer_ticks(vm, length);
+      emit_exit(pc, false);
+      break;
+    }
+    ++length;
+    code_bytes.set(pc);
+    code_bytes.set(pc + 1U);
+    const auto next_pc = static_cast<uint16_t>((pc + 2) & 0x0FFF);
+    const auto skip_pc = static_cast<uint16_t>((pc + 4) & 0x0FFF);
+
+    switch (ins.id) {
+    case opcode_id::op_6XNN:
+      emit_mem({0xC6}, 0, V_offset(ins.x)); // mov byte Vx, nn
+      emit8(ins.nn);
+      break;
+    case opcode_id::op_7XNN:
+      emit_mem({0x80}, 0, V_offset(ins.x)); // add byte Vx, nn
+      emit8(ins.nn);
+      break;
+    case opcode_id::op_8XY0:
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.y));
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    case opcode_id::op_8XY1:
+    case opcode_id::op_8XY2:
+    case opcode_id::op_8XY3: {
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+      emit_mem({0x0F, 0xB6}, reg_ecx, V_offset(ins.y));
+      const uint8_t alu = (ins.id == opcode_id::op_8XY1)   ? 0x09  // or
+                          : (ins.id == opcode_id::op_8XY2) ? 0x21  // and
+                                                           : 0x31; // xor
+      emit8(alu), emit8(0xC8); // op eax, ecx
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    }
+    case opcode_id::op_8XY4:
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+      emit_mem({0x0F, 0xB6}, reg_ecx, V_offset(ins.y));
+      emit8(0x01), emit8(0xC8);               // add eax, ecx
+      emit8(0x89), emit8(0xC2);               // mov edx, eax
+      emit8(0xC1), emit8(0xEA), emit8(0x08);  // shr edx, 8
+      emit_mem({0x88}, reg_edx, VF_offset);   // VF = carry
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    case opcode_id::op_8XY5:
+    case opcode_id::op_8XY7: {
+      // VF is written before the subtraction reads its operands again,
+      // exactly like the interpreter, which matters when X or Y is F
+      const uint8_t lhs = (ins.id == opcode_id::op_8XY5) ? ins.x : ins.y;
+      const uint8_t rhs = (ins.id == opcode_id::op_8XY5) ? ins.y : ins.x;
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(lhs));
+      emit_mem({0x0F, 0xB6}, reg_ecx, V_offset(rhs));
+      emit8(0x39), emit8(0xC8);              // cmp eax, ecx
+      emit8(0x0F), emit8(0x97), emit8(0xC2); // seta dl
+      emit_mem({0x88}, reg_edx, VF_offset);
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(lhs));
+      emit_mem({0x0F, 0xB6}, reg_ecx, V_offset(rhs));
+      emit8(0x29), emit8(0xC8); // sub eax, ecx
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    }
+    case opcode_id::op_8XY6:
+    case opcode_id::op_8XYE:
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.y));
+      if (ins.id == opcode_id::op_8XY6) {
+        emit8(0x83), emit8(0xE0), emit8(0x01); // and eax, 1
+      } else {
+        emit8(0xC1), emit8(0xE8), emit8(0x07); // shr eax, 7
+      }
+      emit_mem({0x88}, reg_eax, VF_offset);
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.y));
+      if (ins.id == opcode_id::op_8XY6) {
+        emit8(0xD1), emit8(0xE8); // shr eax, 1
+      } else {
+        emit8(0xD1), emit8(0xE0); // shl eax, 1
+      }
+      emit_mem({0x88}, reg_eax, V_offset(ins.y));
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.y));
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    case opcode_id::op_ANNN:
+      emit8(0x66);
+      emit_mem({0xC7}, 0, I_offset); // mov word I, nnn
+      emit16(ins.nnn);
+      break;
+    case opcode_id::op_FX1E:
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+      emit_mem({0x0F, 0xB7}, reg_ecx, I_offset);
+      emit8(0x01), emit8(0xC8); // add eax, ecx
+      emit8(0x66);
+      emit_mem({0x89}, reg_eax, I_offset);
+      break;
+    case opcode_id::op_FX29:
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+      emit8(0x8D), emit8(0x04), emit8(0x80); // lea eax, [rax + rax * 4]
+      emit8(0x66);
+      emit_mem({0x89}, reg_eax, I_offset);
+      break;
+    case opcode_id::op_FX07:
+      emit_timer_ticks(vm, length);
+      emit_mem({0x0F, 0xB6}, reg_eax, offset_of(vm, &vm.delay_timer));
+      emit_mem({0x88}, reg_eax, V_offset(ins.x));
+      break;
+    case opcode_id::op_FX15:
+    case opcode_id::op_FX18:
+      emit_timer_ticks(vm, length);
+      emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+      emit_mem({0x88}, reg_eax,
+               offset_of(vm, (ins.id == opcode_id::op_FX15)
+                                 ? &vm.delay_timer
+                                 : &vm.sound_timer));
+      break;
+    case opcode_id::op_1NNN:
+      emit_timer_ticks(vm, length);
+      emit_exit(ins.nnn, true);
+      open = false;
+      break;
+    case opcode_id::op_3XNN:
+    case opcode_id::op_4XNN:
+    case opcode_id::op_5XY0:
+    case opcode_id::op_9XY0: {
+      emit_timer_ticks(vm, length);
+      if ((ins.id == opcode_id::op_3XNN) || (ins.id == opcode_id::op_4XNN)) {
+        emit_mem({0x80}, 7, V_offset(ins.x)); // cmp byte Vx, nn
+        emit8(ins.nn);
+      } else {
+        emit_mem({0x0F, 0xB6}, reg_eax, V_offset(ins.x));
+        emit_mem({0x0F, 0xB6}, reg_ecx, V_offset(ins.y));
+        emit8(0x39), emit8(0xC8); // cmp eax, ecx
+      }
+      const bool skip_if_equal =
+          (ins.id == opcode_id::op_3XNN) || (ins.id == opcode_id::op_5XY0);
+      // jump over the skip path when the condition does not hold
+      emit8(0x0F), emit8(skip_if_equal ? 0x85 : 0x84); // jne / je rel32
+      const std::size_t no_skip_patch = code_size;
+      emit32(0);
+      emit_exit(skip_pc, true);
+      patch_jump(no_skip_patch, code_buffer + code_size);
+      emit_exit(next_pc, true);
+      open = false;
+      break;
+    }
+    case opcode_id::op_2NNN:
+      emit_timer_ticks(vm, length);
+      emit_call_helper(opcode, next_pc);
+      emit_exit(ins.nnn, true);
+      open = false;
+      break;
+    case opcode_id::op_00EE:
+    case opcode_id::op_BNNN:
+      // The target is only known at run time, return to run() which
+      // looks it up
+      emit_timer_ticks(vm, length);
+      emit_call_helper(opcode, next_pc);
+      emit8(0xE9);
+      emit32(0);
+      patch_jump(code_size - sizeof(int32_t), code_buffer + epilogue_offset);
+      open = false;
+      break;
+    case opcode_id::op_FX33:
+    case opcode_id::op_FX55:
+      // Stores may hit translated code. Go back to run() so a stale block
+      // is flushed before anything else executes.
+      emit_timer_ticks(vm, length);
+      emit_call_helper(opcode, next_pc);
+      emit_exit(next_pc, false);
+      open = false;
+      break;
+    default:
+      // 00E0, CXNN, DXYN, FX65 and unknown opcodes
+      emit_call_helper(opcode, next_pc);
+      break;
+    }
+    pc = next_pc;
+  }
+
+  std::memcpy(code_buffer + cmp_length_offset, &length, sizeof(length));
+  std::memcpy(code_buffer + sub_length_offset, &length, sizeof(length));
+  blocks[start_pc] = {entry, static_cast<uint16_t>(length)};
+
+  // Link the blocks that were waiting for this one
+  const auto *const last = std::remove_if(
+      pending_links.begin(), pending_links.begin() + pending_count,
+      [this, start_pc, entry](const pending_link &link) {
+        if (link.target_pc != start_pc) {
+          return false;
+        }
+        patch_jump(link.patch_offset, entry);
+        return true;
+      });
+  pending_count = static_cast<std::size_t>(last - pending_links.begin());
+  set_writable(false);
+  return &blocks[start_pc];
+}
+
+#endif // CHIP8_HAS_JIT
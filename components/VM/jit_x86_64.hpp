@@ -0,0 +1,95 @@
+#ifndef JIT_X86_64_HPP_
+#define JIT_X86_64_HPP_
+
+// Dynamic recompiler for x86-64 Linux hosts. Guest basic blocks are
+// translated into native code the first time they run and executed
+// directly afterwards. It only exists on hosts that can run it; on the
+// ESP32 this header declares nothing.
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_HAS_JIT 1
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+class chip8;
+
+class jit_x86_64 {
+public:
+  jit_x86_64();
+  ~jit_x86_64();
+  jit_x86_64(const jit_x86_64 &) = delete;
+  jit_x86_64 &operator=(const jit_x86_64 &) = delete;
+
+  [[nodiscard]] bool ready() const;
+  // Execute up to cycles guest instructions, fewer if a keypad instruction
+  // asks to stop. Returns the number executed.
+  uint32_t run(chip8 &vm, uint32_t cycles);
+  // The guest wrote length bytes at address
+  void invalidate(uint16_t address, uint16_t length);
+  // Throw away every translated block, e.g. after a new ROM was loaded
+  void invalidate_all();
+
+  // Shared with the generated code, which addresses it through r13
+  struct frame {
+    uint32_t budget;
+  };
+
+private:
+  using entry_fn = void (*)(chip8 *vm, frame *frm, const uint8_t *block);
+
+  struct block_info {
+    const uint8_t *code;
+    uint16_t length; // in guest instructions
+  };
+  // A jmp rel32 at the end of a block waiting for its target to be compiled
+  struct pending_link {
+    std::size_t patch_offset;
+    uint16_t target_pc;
+  };
+
+  static constexpr std::size_t code_buffer_size = 1U << 20;
+  static constexpr uint16_t max_block_length = 64;
+  // Exits beyond this many stay unlinked and return to run() instead
+  static constexpr std::size_t max_pending_links = 1024;
+
+  uint8_t *code_buffer{nullptr};
+  std::size_t code_size{0};
+  std::size_t epilogue_offset{0};
+  entry_fn enter{nullptr};
+  std::array<block_info, 4096> blocks{};
+  // Guest bytes that belong to at least one translated block
+  std::bitset<4096> code_bytes;
+  // Fixed size, so that compiling never allocates
+  std::array<pending_link, max_pending_links> pending_links{};
+  std::size_t pending_count{0};
+  bool flush_pending{false};
+
+  // Per block compile state
+  uint32_t ticks_emitted{0};
+  std::ptrdiff_t pc_offset{0};
+
+  static void execute_helper(chip8 *vm, uint32_t opcode);
+  static void timer_helper(chip8 *vm);
+  static std::ptrdiff_t offset_of(const chip8 &vm, const void *field);
+
+  void set_writable(bool writable);
+  void emit_stubs();
+  const block_info *compile(chip8 &vm, uint16_t pc);
+  void patch_jump(std::size_t patch_offset, const uint8_t *target);
+
+  void emit8(uint8_t byte);
+  void emit16(uint16_t value);
+  void emit32(uint32_t value);
+  void emit64(uint64_t value);
+  void emit_mem(std::initializer_list<uint8_t> opcode, uint8_t reg,
+                std::ptrdiff_t offset);
+  void emit_timer_ticks(const chip8 &vm, uint32_t up_to);
+  void emit_exit(uint16_t target_pc, bool chain);
+  void emit_call_helper(uint16_t opcode, uint16_t next_pc);
+};
+
+#endif // defined(__x86_64__) && defined(__linux__)
+#endif // JIT_X86_64_HPP_
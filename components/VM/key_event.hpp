@@ -0,0 +1,97 @@
+#ifndef KEY_EVENT_HPP_
+#define KEY_EVENT_HPP_
+
+extern "C" {
+#include "esp_timer.h"
+}
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "spsc_ring.hpp"
+
+// What the BLE numpad sends, one byte per event:
+//   0x00 - 0x0F  key went down
+//   0x10 - 0x1F  key (value & 0xF) went up
+//   0xFF         exit key
+// Until a client has sent its first release, each press holds the key
+// down for keyboard::key_hold_frames emulated frames.
+static constexpr uint8_t key_release_flag = 0x10;
+static constexpr uint8_t key_exit = 0xFF;
+
+// Microseconds on a clock that wraps around every 71 minutes, which is
+// far longer than any latency that gets measured with it
+using key_clock_fn = uint32_t (*)();
+static inline uint32_t key_clock_us() {
+  return static_cast<uint32_t>(esp_timer_get_time());
+}
+
+struct key_event {
+  uint8_t code;
+  uint32_t time_us; // when it arrived, on key_clock_us()
+};
+
+using key_event_ring = spsc_ring<key_event, 32>;
+
+// Log-linear histogram of latencies in microseconds. Values below 16 get
+// a bucket each; above that every power of two is split into 8 buckets,
+// so a percentile is never off by more than 12.5%.
+class latency_histogram {
+public:
+  void record(const uint32_t us) {
+    ++buckets[bucket_of(us)];
+    ++samples;
+    largest = (us > largest) ? us : largest;
+  }
+  void clear() { *this = latency_histogram{}; }
+  [[nodiscard]] uint32_t count() const { return samples; }
+  [[nodiscard]] uint32_t max() const { return largest; }
+  // Smallest latency that at least fraction (0 - 1) of the samples did not
+  // exceed, rounded up to the end of its bucket. 0 without samples.
+  [[nodiscard]] uint32_t percentile(const double fraction) const {
+    if (samples == 0) {
+      return 0;
+    }
+    const auto wanted = static_cast<uint32_t>(fraction * samples + 0.5);
+    uint32_t seen = 0;
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+      seen += buckets[i];
+      if ((seen >= wanted) && (seen != 0)) {
+        const uint32_t end = bucket_end(i);
+        return (end < largest) ? end : largest;
+      }
+    }
+    return largest;
+  }
+  [[nodiscard]] uint32_t p50() const { return percentile(0.50); }
+  [[nodiscard]] uint32_t p99() const { return percentile(0.99); }
+
+private:
+  static constexpr std::size_t linear = 16;
+  static constexpr std::size_t steps = 8;
+
+  static std::size_t bucket_of(const uint32_t us) {
+    if (us < linear) {
+      return us;
+    }
+    const auto exponent = static_cast<std::size_t>(31 - __builtin_clz(us));
+    const std::size_t step = (us >> (exponent - 3)) & (steps - 1);
+    return linear + ((exponent - 4) * steps) + step;
+  }
+  // Largest value that still falls into bucket
+  static uint32_t bucket_end(const std::size_t bucket) {
+    if (bucket < linear) {
+      return static_cast<uint32_t>(bucket);
+    }
+    const std::size_t exponent = ((bucket - linear) / steps) + 4;
+    const std::size_t step = (bucket - linear) % steps;
+    const uint64_t start = (uint64_t{steps + step}) << (exponent - 3);
+    return static_cast<uint32_t>(start + (uint64_t{1} << (exponent - 3)) - 1);
+  }
+
+  std::array<uint32_t, linear + ((32 - 4) * steps)> buckets{};
+  uint32_t samples{0};
+  uint32_t largest{0};
+};
+
+#endif // KEY_EVENT_HPP_
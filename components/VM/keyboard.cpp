@@ -4,50 +4,109 @@ extern "C" {
 #include "keyboard.hpp"
 #include <algorithm>
 
-keyboard::keyboard(xQueueHandle numpad_ble) : m_numpad_ble{numpad_ble} {}
+keyboard::keyboard(key_event_ring *numpad_ble, key_clock_fn clock)
+    : m_numpad_ble{numpad_ble}, m_clock{clock} {}
 
 void keyboard::storeKeyPress() {
-  uint8_t value = 0;
-  if (xQueueReceive(m_numpad_ble, &value, (TickType_t)0)) {
-    // Ignore other values
-    if (value <= 0xF) {
-      ESP_LOGD("Keypad", "Key pressed : %#2x", value);
-      Keys[value] = true;
+  if (!m_numpad_ble) {
+    return;
+  }
+  key_event event{};
+  while (m_numpad_ble->pop(event)) {
+    const auto key = static_cast<uint8_t>(event.code & 0xFU);
+    const auto bit = static_cast<uint16_t>(1U << key);
+    if (event.code <= 0xF) {
+      ESP_LOGD("Keypad", "Key pressed : %#2x", event.code);
+      m_down |= bit;
+      m_holdLeft[key] = key_hold_frames;
+      m_latched |= bit;
+      if (!(m_unmeasured & bit)) {
+        m_unmeasured |= bit;
+        m_pressedAt[key] = event.time_us;
+      }
+    } else if ((event.code & 0xF0U) == key_release_flag) {
+      ESP_LOGD("Keypad", "Key released : %#2x", key);
+      m_sendsReleases = true;
+      m_down &= static_cast<uint16_t>(~bit);
     }
     // Exit key is pressed
-    if (value == 0xFF) {
+    if (event.code == key_exit) {
       ESP_LOGD("Keypad", "Exit button pressed");
-      m_exitButton->update();
+      m_exitRequested = true;
+      if (m_exitButton) {
+        m_exitButton->update();
+      }
     }
   }
 }
 
+void keyboard::endFrame() {
+  // Keys of a client that has not sent a release yet come up on their own
+  if (m_sendsReleases) {
+    return;
+  }
+  for (uint16_t held = m_down; held != 0; held &= held - 1) {
+    const auto key = static_cast<uint8_t>(__builtin_ctz(held));
+    if (--m_holdLeft[key] == 0) {
+      m_down &= static_cast<uint16_t>(~(1U << key));
+    }
+  }
+}
+
+void keyboard::observe(const uint8_t key) {
+  const auto bit = static_cast<uint16_t>(1U << key);
+  m_latched &= static_cast<uint16_t>(~bit);
+  if (m_unmeasured & bit) {
+    m_unmeasured &= static_cast<uint16_t>(~bit);
+    m_latency.record(m_clock() - m_pressedAt[key]);
+  }
+}
+
 bool keyboard::isKeyVxPressed(const uint8_t &num) {
-  storeKeyPress();
-  if (Keys[num]) {
-    // reset the keys
-    Keys[num] = false;
+  const auto key = static_cast<uint8_t>(num & 0xFU);
+  if (((m_down | m_latched) >> key) & 1U) {
+    observe(key);
     return true;
   }
-  return Keys[num];
+  return false;
 }
 
 std::optional<uint8_t> keyboard::whichKeyIndexIfPressed() {
-  storeKeyPress();
-  auto *iter = std::find(Keys.begin(), Keys.end(), true);
-  const auto dist = static_cast<uint8_t>(std::distance(Keys.begin(), iter));
-  if (dist != Keys.size()) {
-    // reset the Keys
-    Keys[dist] = false;
-    return dist;
+  if (m_latched) {
+    const auto key = static_cast<uint8_t>(__builtin_ctz(m_latched));
+    observe(key);
+    return key;
   }
   return std::nullopt;
 }
 
+uint16_t keyboard::pressedKeys() const { return m_down | m_latched; }
+
+key_snapshot keyboard::keySnapshot() const { return {m_down, m_latched}; }
+
+void keyboard::restoreKeySnapshot(const key_snapshot &keys) {
+  m_down = keys.down;
+  m_latched = keys.latched;
+  m_unmeasured = 0;
+  m_holdLeft.fill(key_hold_frames);
+}
+
 void keyboard::clearKeyInput() {
-  std::fill_n(Keys.begin(), Keys.size(), false);
+  m_down = 0;
+  m_latched = 0;
+  m_unmeasured = 0;
+  m_exitRequested = false;
 }
 
+bool keyboard::isExitRequested() const { return m_exitRequested; }
+
+uint32_t keyboard::droppedKeyEvents() const {
+  return m_numpad_ble ? m_numpad_ble->dropped_count() : 0;
+}
+
+const latency_histogram &keyboard::inputLatency() const { return m_latency; }
+void keyboard::clearInputLatency() { m_latency.clear(); }
+
 void keyboard::addExitButtonObserver(IObserver *exit_button) {
   if (exit_button) {
     m_exitButton = exit_button;
@@ -1,30 +1,73 @@
 #ifndef KEYBOARD_H_
 #define KEYBOARD_H_
 
-extern "C" {
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-}
 #include <array>
 #include <memory>
 #include <optional>
 #include <cstdint>
+#include "key_event.hpp"
 #include "observer.hpp"
 
+// What the key queries look at, saved and restored with the VM
+struct key_snapshot {
+  uint16_t down;    // between press and release
+  uint16_t latched; // pressed, not looked at yet
+};
+
+// Key state fed by the BLE numpad. Each key is down between its press and
+// release event. Until the client has sent a release, so may never send
+// one, a key also comes up after key_hold_frames emulated frames. A press
+// is also remembered until a key instruction has seen it, so a tap shorter
+// than a frame is not lost.
 class keyboard {
 public:
+  // Emulated frames a key stays down without a release, a quarter of a
+  // second of game time
+  static constexpr uint8_t key_hold_frames = 15;
+
   keyboard() = default;
-  explicit keyboard(xQueueHandle numpad_ble);
+  // clock has to run on the same time base the events were stamped with
+  explicit keyboard(key_event_ring *numpad_ble,
+                    key_clock_fn clock = key_clock_us);
+  // Whether key num is down or was pressed since it was last looked at
   bool isKeyVxPressed(const uint8_t &num);
+  // Lowest key pressed since it was last looked at
   std::optional<uint8_t> whichKeyIndexIfPressed();
+  // Bit n set while key n is down or has an unseen press
+  [[nodiscard]] uint16_t pressedKeys() const;
   void clearKeyInput();
   void addExitButtonObserver(IObserver* exit_button);
+  // Move every key event waiting in the ring into the key state. Called
+  // once per frame, the key queries below only look at that state.
   void storeKeyPress();
+  // One frame of emulated time has passed, called by chip8::run_frame().
+  // Only ages the keys of a client that has not sent a release yet.
+  void endFrame();
+  // Set once the exit key arrived, until the next clearKeyInput()
+  bool isExitRequested() const;
+  // Key events the ring had no room for
+  uint32_t droppedKeyEvents() const;
+  // Time from a press arriving over BLE until the guest first saw it
+  const latency_histogram &inputLatency() const;
+  void clearInputLatency();
+  [[nodiscard]] key_snapshot keySnapshot() const;
+  // Presses restored this way are not counted in the input latency
+  void restoreKeySnapshot(const key_snapshot &keys);
 
 private:
-  xQueueHandle m_numpad_ble;
-  std::array<bool, 16> Keys{false};
-  IObserver* m_exitButton;
+  key_event_ring *m_numpad_ble{nullptr};
+  key_clock_fn m_clock{key_clock_us};
+  uint16_t m_down{0};       // between press and release
+  uint16_t m_latched{0};    // pressed, not looked at yet
+  uint16_t m_unmeasured{0}; // pressed, latency not recorded yet
+  std::array<uint32_t, 16> m_pressedAt{};
+  std::array<uint8_t, 16> m_holdLeft{}; // frames until down ends, no releases
+  bool m_sendsReleases{false};
+  latency_histogram m_latency;
+  IObserver* m_exitButton{nullptr};
+  bool m_exitRequested{false};
+
+  void observe(uint8_t key);
 };
 
 #endif // KEYBOARD_H_
@@ -0,0 +1,87 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "decoder.hpp"
+
+// Where guest time goes: how often every opcode ran and how often every
+// address was executed. chip8 only keeps one of these when
+// CONFIG_CHIP8_PROFILER is set, otherwise recording compiles to nothing.
+//
+// dump() writes a plain text format, one record per line, that
+// host/chip8_profile turns into a sorted hot spot report:
+//   chip8-profile 1
+//   total <instructions>
+//   op <opcode name> <count>     for every opcode that ran
+//   pc <address> <count>         for every address that ran, in hex
+class vm_profile {
+public:
+  static constexpr std::size_t address_count = 4096;
+
+  void record(const uint16_t pc, const opcode_id id) {
+    ++opcodes[static_cast<std::size_t>(id)];
+    ++addresses[pc & (address_count - 1)];
+    ++instructions;
+  }
+  void clear() { *this = vm_profile{}; }
+
+  [[nodiscard]] uint32_t total() const { return instructions; }
+  [[nodiscard]] uint32_t opcode_count(const opcode_id id) const {
+    return opcodes[static_cast<std::size_t>(id)];
+  }
+  [[nodiscard]] uint32_t pc_hits(const uint16_t pc) const {
+    return addresses[pc & (address_count - 1)];
+  }
+
+  void dump(std::FILE *out) const {
+    std::fprintf(out, "chip8-profile 1\ntotal %" PRIu32 "\n", instructions);
+    for (std::size_t id = 0; id < opcodes.size(); ++id) {
+      if (opcodes[id] != 0) {
+        std::fprintf(out, "op %s %" PRIu32 "\n", opcode_names[id],
+                     opcodes[id]);
+      }
+    }
+    for (std::size_t pc = 0; pc < addresses.size(); ++pc) {
+      if (addresses[pc] != 0) {
+        std::fprintf(out, "pc %03zx %" PRIu32 "\n", pc, addresses[pc]);
+      }
+    }
+  }
+
+  // Reads one record written by dump(), returns false for anything else
+  bool parse_line(const char *line) {
+    char name[16];
+    unsigned int pc = 0;
+    uint32_t count = 0;
+    if (std::sscanf(line, "total %" SCNu32, &count) == 1) {
+      instructions = count;
+      return true;
+    }
+    if (std::sscanf(line, "pc %x %" SCNu32, &pc, &count) == 2) {
+      addresses[pc & (address_count - 1)] = count;
+      return true;
+    }
+    if (std::sscanf(line, "op %15s %" SCNu32, name, &count) == 2) {
+      for (std::size_t id = 0; id < opcode_names.size(); ++id) {
+        if (std::strcmp(name, opcode_names[id]) == 0) {
+          opcodes[id] = count;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+private:
+  std::array<uint32_t, opcode_id_count> opcodes{};
+  std::array<uint32_t, address_count> addresses{};
+  uint32_t instructions{0};
+};
+
+#endif // PROFILER_HPP_
@@ -0,0 +1,284 @@
+#ifndef REWIND_HPP_
+#define REWIND_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "save_state.hpp"
+
+// Save states of the last frames, packed into Bytes of memory. Every
+// Interval-th frame is a keyframe, the ones in between are deltas against
+// the frame before them. Both are stored as the XOR against their base
+// (all zeros for a keyframe), run length encoded:
+//   repeated { u16 unchanged bytes, u8 changed bytes n, n XORed bytes }
+// Most of guest memory is zero and most of it never changes between
+// frames, so a keyframe takes a few hundred bytes and a delta a few dozen.
+// Restoring a frame decodes its keyframe and every delta up to it.
+//
+// The records follow each other in a byte ring and never wrap around its
+// end. Each one starts with a 4 byte header: u16 encoded size, u8 kind,
+// u8 unused. When there is no room, the oldest records go first, together
+// with any deltas their keyframe took with it.
+template <std::size_t Bytes, uint32_t Interval> class rewind_ring {
+  static_assert(Interval != 0, "rewind_ring needs keyframes");
+
+public:
+  void clear() {
+    head = 0;
+    tail = 0;
+    count = 0;
+    base_live = false;
+    since_key = 0;
+    key_count = 0;
+  }
+
+  // Append the state of the frame that just finished
+  void capture(const saved_state &state) {
+    bool key = !base_live || (since_key + 1 >= Interval);
+    std::size_t size = encode(state.data(), key ? nullptr : base.data(),
+                              nullptr);
+    std::size_t at = make_room(header_size + size);
+    // Making room can take the frame this delta is against
+    if (!key && !base_live) {
+      key = true;
+      size = encode(state.data(), nullptr, nullptr);
+      at = make_room(header_size + size);
+    }
+
+    put_u16(&ring[at], static_cast<uint16_t>(size));
+    ring[at + 2] = key ? keyframe : delta;
+    ring[at + 3] = 0;
+    encode(state.data(), key ? nullptr : base.data(),
+           &ring[at + header_size]);
+    head = at + header_size + size;
+    ++count;
+    base = state;
+    base_live = true;
+    if (key) {
+      since_key = 0;
+      ++key_count;
+    } else {
+      ++since_key;
+    }
+  }
+
+  // Put the state from frames captures before the newest one in out and
+  // forget everything newer, so capturing continues from there. Goes back
+  // as far as the ring reaches; returns how many frames that was.
+  uint32_t restore(const uint32_t frames, saved_state &out) {
+    if (count == 0) {
+      return 0;
+    }
+    const uint32_t back = std::min<uint32_t>(frames, count - 1);
+    const uint32_t target = count - 1 - back;
+
+    std::size_t pos = tail;
+    std::size_t key_pos = tail;
+    uint32_t key_index = 0;
+    uint32_t keys = 0;
+    for (uint32_t index = 0;; ++index) {
+      pos = normalize(pos);
+      if (ring[pos + 2] == keyframe) {
+        key_pos = pos;
+        key_index = index;
+        ++keys;
+      }
+      if (index == target) {
+        break;
+      }
+      pos += header_size + get_u16(&ring[pos]);
+    }
+
+    // The keyframe, then every delta up to the target on top of it
+    base.fill(0);
+    for (std::size_t at = key_pos;; at = normalize(at)) {
+      decode(&ring[at + header_size], base.data());
+      if (at == pos) {
+        break;
+      }
+      at += header_size + get_u16(&ring[at]);
+    }
+    out = base;
+    head = pos + header_size + get_u16(&ring[pos]);
+    count = target + 1;
+    base_live = true;
+    since_key = target - key_index;
+    key_count = keys;
+    return back;
+  }
+
+  [[nodiscard]] bool empty() const { return count == 0; }
+  // Frames restore() can go back from the newest one
+  [[nodiscard]] uint32_t frames() const {
+    return (count == 0) ? 0 : count - 1;
+  }
+  [[nodiscard]] uint32_t keyframes() const { return key_count; }
+  // Bytes of the ring holding records
+  [[nodiscard]] std::size_t used() const {
+    if (count == 0) {
+      return 0;
+    }
+    return (head > tail) ? (head - tail) : (Bytes - tail + head);
+  }
+  static constexpr std::size_t capacity() { return Bytes; }
+
+private:
+  static constexpr std::size_t header_size = 4;
+  static constexpr uint8_t delta = 0;
+  static constexpr uint8_t keyframe = 1;
+  static constexpr uint8_t wrap = 2;
+  // Every byte changed: one run header per 255 of them
+  static constexpr std::size_t worst_record =
+      header_size + save_state_size + (3 * ((save_state_size + 254) / 255));
+  static_assert(Bytes >= 2 * worst_record,
+                "rewind_ring has to hold at least two full states");
+
+  static void put_u16(uint8_t *out, const uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+  }
+  static uint16_t get_u16(const uint8_t *in) {
+    return static_cast<uint16_t>(in[0] | (in[1] << 8));
+  }
+
+  // Write state XOR base (zeros without a base) to out and return its
+  // size. Without out only the size is worked out.
+  static std::size_t encode(const uint8_t *state, const uint8_t *base,
+                            uint8_t *out) {
+    auto changed = [state, base](const std::size_t i) {
+      return static_cast<uint8_t>(state[i] ^ (base ? base[i] : 0));
+    };
+    // Unchanged stretches are skipped a word at a time
+    auto word_unchanged = [state, base](const std::size_t i) {
+      uint32_t now;
+      uint32_t before = 0;
+      std::memcpy(&now, state + i, sizeof(now));
+      if (base) {
+        std::memcpy(&before, base + i, sizeof(before));
+      }
+      return now == before;
+    };
+    std::size_t size = 0;
+    std::size_t i = 0;
+    while (i < save_state_size) {
+      std::size_t same = 0;
+      while (((i + 4) <= save_state_size) && ((same + 4) <= UINT16_MAX) &&
+             word_unchanged(i)) {
+        i += 4;
+        same += 4;
+      }
+      while ((i < save_state_size) && (same < UINT16_MAX) &&
+             (changed(i) == 0)) {
+        ++i;
+        ++same;
+      }
+      std::size_t run = 0;
+      while (((i + run) < save_state_size) && (run < UINT8_MAX) &&
+             (changed(i + run) != 0)) {
+        ++run;
+      }
+      if (out) {
+        put_u16(out + size, static_cast<uint16_t>(same));
+        out[size + 2] = static_cast<uint8_t>(run);
+        for (std::size_t n = 0; n < run; ++n) {
+          out[size + 3 + n] = changed(i + n);
+        }
+      }
+      size += 3 + run;
+      i += run;
+    }
+    return size;
+  }
+
+  // XOR an encoded record into state
+  static void decode(const uint8_t *in, uint8_t *state) {
+    std::size_t i = 0;
+    while (i < save_state_size) {
+      i += get_u16(in);
+      const uint8_t run = in[2];
+      for (std::size_t n = 0; n < run; ++n) {
+        state[i + n] ^= in[3 + n];
+      }
+      i += run;
+      in += 3 + run;
+    }
+  }
+
+  // Where the record at pos really starts: past the end of the ring goes
+  // on at the beginning
+  std::size_t normalize(const std::size_t pos) const {
+    return ((pos + header_size > Bytes) || (ring[pos + 2] == wrap)) ? 0 : pos;
+  }
+
+  void drop_oldest() {
+    if (ring[tail + 2] == keyframe) {
+      --key_count;
+    }
+    tail += header_size + get_u16(&ring[tail]);
+    --count;
+    if (count == 0) {
+      head = 0;
+      tail = 0;
+    } else {
+      tail = normalize(tail);
+    }
+  }
+
+  // The oldest keyframe and the deltas against it
+  void drop_oldest_segment() {
+    do {
+      drop_oldest();
+    } while ((count != 0) && (ring[tail + 2] != keyframe));
+    // Segments go oldest first, so the newest frame is the last to go
+    base_live = (count != 0);
+  }
+
+  // Offset where size bytes fit, after dropping as many of the oldest
+  // records as that takes
+  std::size_t make_room(const std::size_t size) {
+    while (count != 0) {
+      // Not wrapped around the end of the ring yet
+      if (head > tail) {
+        if (head + size <= Bytes) {
+          return head;
+        }
+        if (size <= tail) {
+          if (head + header_size <= Bytes) {
+            ring[head + 2] = wrap;
+          }
+          return 0;
+        }
+      } else if (head + size <= tail) {
+        return head;
+      }
+      drop_oldest_segment();
+    }
+    head = 0;
+    tail = 0;
+    return 0;
+  }
+
+  std::array<uint8_t, Bytes> ring;
+  // The newest frame, which the next delta is written against
+  saved_state base{};
+  std::size_t head{0};
+  std::size_t tail{0};
+  uint32_t count{0};
+  uint32_t since_key{0};
+  uint32_t key_count{0};
+  bool base_live{false};
+};
+
+// A rewind_ring sized so that it and the saved_state each frame is taken
+// into before capture() fit in Budget bytes. Besides its records the ring
+// holds a keyframe of its own and a few counters.
+static constexpr std::size_t rewind_ring_counters = 64;
+template <std::size_t Budget, uint32_t Interval>
+using rewind_ring_within =
+    rewind_ring<Budget - (2 * save_state_size) - rewind_ring_counters,
+                Interval>;
+
+#endif // REWIND_HPP_
@@ -0,0 +1,41 @@
+#ifndef RNG_HPP_
+#define RNG_HPP_
+
+#include <cstdint>
+
+// Marsaglia's xorshift32: one word of state and three shifts per number,
+// plenty for CXNN. seed() runs the value through the murmur3 finalizer
+// first, as small seeds like 1 or 2 would otherwise start with a run of
+// near-zero numbers. A zero state would only ever produce zeros, so that
+// one is replaced by a fixed non-zero value.
+class xorshift32 {
+public:
+  void seed(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x85EBCA6BU;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35U;
+    value ^= value >> 16;
+    state = (value != 0) ? value : default_seed;
+  }
+  uint32_t next() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+  // The high bits are the better mixed ones
+  uint8_t next_byte() { return static_cast<uint8_t>(next() >> 24); }
+  // The raw state, for save states. Unlike seed() it is taken as is.
+  [[nodiscard]] uint32_t get_state() const { return state; }
+  void set_state(const uint32_t value) {
+    state = (value != 0) ? value : default_seed;
+  }
+
+private:
+  static constexpr uint32_t default_seed = 0x9E3779B9;
+
+  uint32_t state{default_seed};
+};
+
+#endif // RNG_HPP_
@@ -0,0 +1,84 @@
+#ifndef SAVE_STATE_HPP_
+#define SAVE_STATE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Layout of chip8::save_state(), all fields little endian:
+//   "C8SS", u16 version (1), u16 reserved (0)
+//   memory, 4096 bytes
+//   V0..VF, 16 bytes
+//   u16 I, u16 program counter, u8 delay timer, u8 sound timer
+//   u8 stack depth, 16 x u16 return addresses, oldest first
+//   u32 stack overflows, u32 stack underflows
+//   32 x u64 framebuffer rows
+//   u32 random generator state
+//   u32 cycles per frame, u32 instructions since the timers counted down
+//   u16 keys down, u16 keys pressed but not looked at yet
+//   u8 display flag
+// A new version gets a new number; older ones are rejected, not guessed at.
+static constexpr uint16_t save_state_version = 1;
+static constexpr std::size_t save_state_size =
+    8 + 4096 + 16 + 6 + (1 + (16 * 2)) + 8 + (32 * 8) + 4 + 8 + 4 + 1;
+
+using saved_state = std::array<uint8_t, save_state_size>;
+
+// Appends little endian fields to a buffer the caller made big enough
+class state_writer {
+public:
+  explicit state_writer(uint8_t *out) : pos{out} {}
+
+  void u8(const uint8_t value) { *pos++ = value; }
+  void u16(const uint16_t value) {
+    u8(static_cast<uint8_t>(value));
+    u8(static_cast<uint8_t>(value >> 8));
+  }
+  void u32(const uint32_t value) {
+    u16(static_cast<uint16_t>(value));
+    u16(static_cast<uint16_t>(value >> 16));
+  }
+  void u64(const uint64_t value) {
+    u32(static_cast<uint32_t>(value));
+    u32(static_cast<uint32_t>(value >> 32));
+  }
+  void bytes(const uint8_t *data, const std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      *pos++ = data[i];
+    }
+  }
+
+private:
+  uint8_t *pos;
+};
+
+// The other direction. The caller checks the size up front.
+class state_reader {
+public:
+  explicit state_reader(const uint8_t *in) : pos{in} {}
+
+  uint8_t u8() { return *pos++; }
+  uint16_t u16() {
+    const uint8_t low = u8();
+    return static_cast<uint16_t>(low | (u8() << 8));
+  }
+  uint32_t u32() {
+    const uint16_t low = u16();
+    return low | (static_cast<uint32_t>(u16()) << 16);
+  }
+  uint64_t u64() {
+    const uint32_t low = u32();
+    return low | (static_cast<uint64_t>(u32()) << 32);
+  }
+  // Where the next field starts, for copying whole arrays out
+  const uint8_t *skip(const std::size_t size) {
+    const uint8_t *start = pos;
+    pos += size;
+    return start;
+  }
+
+private:
+  const uint8_t *pos;
+};
+
+#endif // SAVE_STATE_HPP_
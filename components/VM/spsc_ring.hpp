@@ -0,0 +1,59 @@
+#ifndef SPSC_RING_HPP_
+#define SPSC_RING_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free ring buffer for exactly one producer and one consumer, e.g.
+// the BLE task handing key presses to the emulator. Neither side ever
+// blocks: push() fails when the ring is full and counts the value as
+// dropped, pop() fails when it is empty.
+//
+// head and tail only ever count up and wrap around at 2^32, which is why
+// Capacity has to be a power of two. They live on separate cache lines
+// so the two sides do not keep stealing each other's line.
+template <typename T, std::size_t Capacity> class spsc_ring {
+  static_assert((Capacity != 0) && ((Capacity & (Capacity - 1)) == 0),
+                "Capacity must be a power of two");
+
+public:
+  // Producer side
+  bool push(const T &value) {
+    const uint32_t head_now = head.load(std::memory_order_relaxed);
+    if ((head_now - tail.load(std::memory_order_acquire)) == Capacity) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots[head_now & mask] = value;
+    head.store(head_now + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T &value) {
+    const uint32_t tail_now = tail.load(std::memory_order_relaxed);
+    if (tail_now == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = slots[tail_now & mask];
+    tail.store(tail_now + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Values push() had to throw away, safe to read from either side
+  [[nodiscard]] uint32_t dropped_count() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr uint32_t mask = Capacity - 1;
+
+  std::array<T, Capacity> slots{};
+  alignas(64) std::atomic<uint32_t> head{0}; // next slot push() fills
+  alignas(64) std::atomic<uint32_t> tail{0}; // next slot pop() reads
+  std::atomic<uint32_t> dropped{0};
+};
+
+#endif // SPSC_RING_HPP_
@@ -0,0 +1,95 @@
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// One executed instruction: where it was, what it was and the state it
+// left behind. Which registers an opcode writes follows from the opcode,
+// so only VX and VF are kept, which covers everything but FX65.
+struct trace_record {
+  uint32_t cycle; // instructions executed before this one
+  uint16_t pc;
+  uint16_t opcode;
+  uint16_t i;     // I after the instruction
+  uint8_t vx;     // V[X] after the instruction
+  uint8_t vf;     // V[F] after the instruction
+};
+static_assert(sizeof(trace_record) == 12, "trace_record is a file format");
+
+// The last Capacity instructions the VM executed. Recording overwrites
+// the oldest record once the ring is full and never allocates, so it is
+// cheap enough to leave on for millions of instructions.
+//
+// write() produces the file tools/chip8_trace.py decodes, all fields
+// little endian:
+//   "C8TR", u16 version (1), u16 record size (12),
+//   u32 records in the file, u32 records ever recorded,
+//   then the records, oldest first, in trace_record field order
+template <std::size_t Capacity> class trace_ring {
+  static_assert(Capacity != 0, "trace_ring needs at least one record");
+
+public:
+  void record(const uint16_t pc, const uint16_t opcode, const uint16_t i,
+              const uint8_t vx, const uint8_t vf) {
+    records[next] = {recorded, pc, opcode, i, vx, vf};
+    next = (next + 1 == Capacity) ? 0 : next + 1;
+    ++recorded;
+  }
+  void clear() {
+    next = 0;
+    recorded = 0;
+  }
+  [[nodiscard]] uint32_t total() const { return recorded; }
+  [[nodiscard]] std::size_t size() const {
+    return (recorded < Capacity) ? recorded : Capacity;
+  }
+
+  bool write(std::FILE *out) const {
+    uint8_t header[16] = {'C', '8', 'T', 'R'};
+    put_u16(header + 4, version);
+    put_u16(header + 6, sizeof(trace_record));
+    put_u32(header + 8, static_cast<uint32_t>(size()));
+    put_u32(header + 12, recorded);
+    if (std::fwrite(header, sizeof(header), 1, out) != 1) {
+      return false;
+    }
+    // The oldest record is the one that gets overwritten next
+    std::size_t index = (recorded < Capacity) ? 0 : next;
+    for (std::size_t n = 0; n < size(); ++n) {
+      const trace_record &entry = records[index];
+      uint8_t bytes[sizeof(trace_record)];
+      put_u32(bytes, entry.cycle);
+      put_u16(bytes + 4, entry.pc);
+      put_u16(bytes + 6, entry.opcode);
+      put_u16(bytes + 8, entry.i);
+      bytes[10] = entry.vx;
+      bytes[11] = entry.vf;
+      if (std::fwrite(bytes, sizeof(bytes), 1, out) != 1) {
+        return false;
+      }
+      index = (index + 1 == Capacity) ? 0 : index + 1;
+    }
+    return true;
+  }
+
+private:
+  static constexpr uint16_t version = 1;
+
+  static void put_u16(uint8_t *out, const uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+  }
+  static void put_u32(uint8_t *out, const uint32_t value) {
+    put_u16(out, static_cast<uint16_t>(value));
+    put_u16(out + 2, static_cast<uint16_t>(value >> 16));
+  }
+
+  std::array<trace_record, Capacity> records;
+  std::size_t next{0};
+  uint32_t recorded{0};
+};
+
+#endif // TRACE_HPP_
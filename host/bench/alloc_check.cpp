@@ -0,0 +1,148 @@
+// Checks that the VM never touches the heap while it runs. Every global
+// operator new is replaced by one that counts while a run is in progress;
+// each bundled ROM then runs for a number of instructions in every
+// dispatch mode, and any allocation in between fails the check. Building
+// the VM, loading the ROM and switching modes may allocate.
+//
+// usage: chip8_alloc [cycles]
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aot_roms.hpp"
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint64_t default_cycles = 1'000'000;
+
+static std::atomic<bool> counting{false};
+static std::atomic<uint64_t> allocations{0};
+
+static void *counted_alloc(const std::size_t size) {
+  if (counting.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void *block = std::malloc((size != 0) ? size : 1);
+  if (!block) {
+    throw std::bad_alloc{};
+  }
+  return block;
+}
+
+static void *counted_alloc(const std::size_t size, const std::align_val_t align) {
+  if (counting.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  const auto alignment = static_cast<std::size_t>(align);
+  // aligned_alloc wants the size to be a multiple of the alignment
+  void *block = std::aligned_alloc(
+      alignment, ((std::max<std::size_t>(size, 1) + alignment - 1) /
+                  alignment) * alignment);
+  if (!block) {
+    throw std::bad_alloc{};
+  }
+  return block;
+}
+
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void *operator new(std::size_t size, std::align_val_t align) {
+  return counted_alloc(size, align);
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return counted_alloc(size, align);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return counted_alloc(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return counted_alloc(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void operator delete(void *block) noexcept { std::free(block); }
+void operator delete[](void *block) noexcept { std::free(block); }
+void operator delete(void *block, std::size_t) noexcept { std::free(block); }
+void operator delete[](void *block, std::size_t) noexcept { std::free(block); }
+void operator delete(void *block, std::align_val_t) noexcept {
+  std::free(block);
+}
+void operator delete[](void *block, std::align_val_t) noexcept {
+  std::free(block);
+}
+void operator delete(void *block, std::size_t, std::align_val_t) noexcept {
+  std::free(block);
+}
+void operator delete[](void *block, std::size_t, std::align_val_t) noexcept {
+  std::free(block);
+}
+
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+static const std::vector<std::pair<dispatch_mode, const char *>> MODES = {
+    {dispatch_mode::reference, "reference"},
+    {dispatch_mode::table, "table"},
+    {dispatch_mode::predecoded, "predecoded"},
+    {dispatch_mode::fused, "fused"},
+#ifdef CHIP8_HAS_JIT
+    {dispatch_mode::jit, "jit"},
+#endif
+    {dispatch_mode::aot, "aot"},
+};
+
+int main(int argc, char **argv) {
+  const uint64_t cycles =
+      (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : default_cycles;
+
+  bool ok = true;
+  for (const auto rom : ROMS) {
+    for (const auto &[mode, name] : MODES) {
+      keyboard numpad;
+      auto emulator = std::make_unique<chip8>(&numpad);
+      emulator->set_fixed_seed(1);
+      emulator->set_dispatch_mode(mode);
+      emulator->load_memory(std::string{CHIP8_ROM_DIR} + '/' +
+                            std::string{rom});
+      if (mode == dispatch_mode::aot) {
+        emulator->attach_aot(find_aot_rom(rom));
+      }
+
+      allocations = 0;
+      counting = true;
+      uint64_t done = 0;
+      while (done < cycles) {
+        numpad.storeKeyPress();
+        const auto batch = emulator->run_cycles(static_cast<uint32_t>(
+            std::min<uint64_t>(cycles - done, emulator->get_cycles_per_frame())));
+        static_cast<void>(emulator->take_display_damage());
+        done += batch.cycles;
+        // A game waiting for a key never gets one here
+        if (batch.cycles == 0) {
+          break;
+        }
+      }
+      counting = false;
+
+      const bool clean = (allocations == 0);
+      ok = ok && clean;
+      std::printf("%-16s %-10s %9llu instructions %6llu allocations %s\n",
+                  rom.data(), name, static_cast<unsigned long long>(done),
+                  static_cast<unsigned long long>(allocations.load()),
+                  clean ? "ok" : "FAILED");
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
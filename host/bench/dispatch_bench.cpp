@@ -0,0 +1,188 @@
+// Compares the instructions per second of the dispatch engines in
+// components/VM/cpu.cpp, on small loops that each exercise one class of
+// opcodes and on the bundled ROMs. With --json the results are written
+// as a single JSON document instead of a table, for tracking them across
+// releases.
+//
+// usage: chip8_bench [--json] [cycles]
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "aot_roms.hpp"
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint64_t default_cycles = 5'000'000;
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+
+struct mode_info {
+  dispatch_mode mode;
+  const char *name;
+};
+static const std::vector<mode_info> MODES = {
+    {dispatch_mode::reference, "reference"},
+    {dispatch_mode::table, "table"},
+    {dispatch_mode::predecoded, "predecoded"},
+    {dispatch_mode::fused, "fused"},
+#ifdef CHIP8_HAS_JIT
+    {dispatch_mode::jit, "jit"},
+#endif
+    {dispatch_mode::aot, "aot"},
+};
+
+// A loop of body repeated until it fills most of the program area, closed
+// by a jump back to the start
+static std::vector<uint8_t> unrolled(const std::vector<uint16_t> &body) {
+  std::vector<uint8_t> program;
+  for (std::size_t copy = 0; copy < 32; ++copy) {
+    for (const uint16_t opcode : body) {
+      program.push_back(static_cast<uint8_t>(opcode >> 8));
+      program.push_back(static_cast<uint8_t>(opcode));
+    }
+  }
+  program.push_back(0x12);
+  program.push_back(0x00);
+  return program;
+}
+
+struct micro_info {
+  const char *name;
+  std::vector<uint8_t> program;
+};
+static const std::vector<micro_info> MICROS = {
+    // 8XY0 - 8XYE on V0 - V3
+    {"alu_8xyn", unrolled({0x8014, 0x8125, 0x8231, 0x8302, 0x8013, 0x8106,
+                           0x820E, 0x8317, 0x8030})},
+    // Sprites of every height at moving positions, so some of them wrap and
+    // clip
+    {"draw_dxyn", unrolled({0xA000, 0x7003, 0x7105, 0xD015, 0xD01F, 0x7207,
+                            0xD231, 0xD018})},
+    // Save and restore all registers above the program
+    {"mem_fx55_fx65", unrolled({0xAE00, 0xFF55, 0xAE10, 0xFF65, 0xAE00, 0xF755,
+                                0xF765})},
+    // Every skip, half of them taken; V0 and V1 stay 0
+    {"skips", unrolled({0x3000, 0x6101, 0x4001, 0x6101, 0x5010, 0x6101,
+                        0x9010, 0x6100, 0x3001, 0x4000})},
+    {"rand_cxnn", unrolled({0xC0FF, 0xC10F, 0xC2F0, 0xC355})},
+};
+
+struct result {
+  const char *kind; // "micro" or "rom"
+  std::string name;
+  const char *mode;
+  double ips;
+};
+
+// Instructions per second running cycles instructions on a VM prepared by
+// load
+template <typename Load>
+static double measure(dispatch_mode mode, uint64_t cycles, Load load) {
+  keyboard numpad;
+  chip8 emulator{&numpad};
+  emulator.set_dispatch_mode(mode);
+  // Every engine sees the same random numbers
+  emulator.set_fixed_seed(1);
+  load(emulator);
+
+  const auto begin = std::chrono::steady_clock::now();
+  for (uint64_t done = 0; done < cycles;) {
+    done += emulator
+                .run_cycles(static_cast<uint32_t>(
+                    std::min<uint64_t>(cycles - done, 100'000)))
+                .cycles;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = end - begin;
+  return static_cast<double>(cycles) / elapsed.count();
+}
+
+static double run_rom(std::string_view rom, dispatch_mode mode,
+                      uint64_t cycles) {
+  return measure(mode, cycles, [rom, mode](chip8 &emulator) {
+    std::string path = CHIP8_ROM_DIR;
+    path += '/';
+    path += rom;
+    emulator.load_memory(path);
+    if (mode == dispatch_mode::aot) {
+      emulator.attach_aot(find_aot_rom(rom));
+    }
+  });
+}
+
+static double run_micro(const micro_info &micro, dispatch_mode mode,
+                        uint64_t cycles) {
+  return measure(mode, cycles, [&micro](chip8 &emulator) {
+    emulator.load_memory(micro.program);
+  });
+}
+
+static void print_table(const std::vector<result> &results) {
+  std::printf("%-16s %-10s %14s %10s %8s\n", "benchmark", "mode", "instr/s",
+              "ns/instr", "speedup");
+  double baseline = 0;
+  for (const auto &entry : results) {
+    if (std::strcmp(entry.mode, "reference") == 0) {
+      baseline = entry.ips;
+    }
+    std::printf("%-16s %-10s %14.0f %10.2f %7.2fx\n", entry.name.c_str(),
+                entry.mode, entry.ips, 1e9 / entry.ips, entry.ips / baseline);
+  }
+}
+
+static void print_json(const std::vector<result> &results, uint64_t cycles) {
+  std::printf("{\n  \"cycles\": %llu,\n  \"results\": [\n",
+              static_cast<unsigned long long>(cycles));
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &entry = results[i];
+    std::printf("    {\"kind\": \"%s\", \"name\": \"%s\", \"mode\": \"%s\", "
+                "\"instructions_per_second\": %.0f, "
+                "\"ns_per_instruction\": %.3f}%s\n",
+                entry.kind, entry.name.c_str(), entry.mode, entry.ips,
+                1e9 / entry.ips, (i + 1 < results.size()) ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  bool json = false;
+  uint64_t cycles = default_cycles;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      cycles = std::strtoull(argv[i], nullptr, 10);
+    }
+  }
+
+  std::vector<result> results;
+  for (const auto &micro : MICROS) {
+    for (const auto &[mode, name] : MODES) {
+      // Only the bundled ROMs are translated ahead of time
+      if (mode != dispatch_mode::aot) {
+        results.push_back(
+            {"micro", micro.name, name, run_micro(micro, mode, cycles)});
+      }
+    }
+  }
+  for (const auto rom : ROMS) {
+    for (const auto &[mode, name] : MODES) {
+      results.push_back(
+          {"rom", std::string{rom}, name, run_rom(rom, mode, cycles)});
+    }
+  }
+
+  if (json) {
+    print_json(results, cycles);
+  } else {
+    print_table(results);
+  }
+  return 0;
+}
@@ -0,0 +1,232 @@
+// Headless runner for many independent VMs at once, for ROM regression
+// runs and input sweeps. Every instance plays one of the bundled ROMs with
+// its own scripted key presses and runs in quanta of a fixed number of
+// instructions. Worker threads take the quanta from their own queue and
+// steal from the others when theirs runs dry, so instances that finish
+// early (a game waiting for a key gives up the rest of its quantum) do not
+// leave a core idle.
+//
+// The whole fleet runs once per thread count, doubling up to the maximum,
+// and reports instructions per second and the speedup over one thread.
+// The input script only depends on the instance and the quantum, so each
+// instance has to end in the same state no matter which threads ran it;
+// a run that does not is reported as FAILED.
+//
+// usage: chip8_fleet [instances] [quanta] [quantum cycles] [max threads]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint32_t default_instances = 1000;
+static constexpr uint32_t default_quanta = 20;
+static constexpr uint32_t default_quantum = 10'000;
+
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+
+// One VM with its keypad and input script
+struct instance {
+  key_event_ring ring;
+  keyboard numpad{&ring};
+  chip8 vm{&numpad};
+  uint32_t script;
+  uint32_t quanta_done{0};
+  uint64_t instructions{0};
+  uint8_t key{0};
+  bool key_down{false};
+
+  instance(const uint32_t id, const std::string_view rom) : script{id + 1} {
+    vm.set_fixed_seed(id);
+    vm.set_dispatch_mode(dispatch_mode::fused);
+    vm.load_memory(std::string{CHIP8_ROM_DIR} + '/' + std::string{rom});
+  }
+
+  // Press or release a key every other quantum, then run the quantum
+  void run_quantum(const uint32_t cycles) {
+    script = (script * 1103515245U) + 12345U;
+    if (key_down) {
+      static_cast<void>(ring.push(
+          {static_cast<uint8_t>(key | key_release_flag), quanta_done}));
+      key_down = false;
+    } else if (((script >> 16) & 1U) != 0) {
+      key = static_cast<uint8_t>((script >> 8) & 0xFU);
+      static_cast<void>(ring.push({key, quanta_done}));
+      key_down = true;
+    }
+    numpad.storeKeyPress();
+    uint32_t done = 0;
+    while (done < cycles) {
+      const auto batch = vm.run_cycles(cycles - done);
+      done += batch.cycles;
+      // Waiting for a key that only the next quantum can bring
+      if (batch.reason != run_stop::budget) {
+        break;
+      }
+    }
+    instructions += done;
+    ++quanta_done;
+  }
+
+  // FNV-1a over the save state
+  [[nodiscard]] uint64_t fingerprint() const {
+    saved_state state;
+    vm.save_state(state);
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const uint8_t byte : state) {
+      hash = (hash ^ byte) * 0x100000001B3ULL;
+    }
+    return hash;
+  }
+};
+
+// The instances a worker runs next. The owner takes from the back and
+// requeues at the front, so its own instances take turns; thieves take
+// from the front, which is the one the owner would get to last.
+class work_queue {
+public:
+  void push(const uint32_t id) {
+    const std::lock_guard<std::mutex> guard{lock};
+    items.push_front(id);
+  }
+  bool pop(uint32_t &id) {
+    const std::lock_guard<std::mutex> guard{lock};
+    if (items.empty()) {
+      return false;
+    }
+    id = items.back();
+    items.pop_back();
+    return true;
+  }
+  bool steal(uint32_t &id) {
+    const std::lock_guard<std::mutex> guard{lock};
+    if (items.empty()) {
+      return false;
+    }
+    id = items.front();
+    items.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex lock;
+  std::deque<uint32_t> items;
+};
+
+struct fleet_result {
+  double seconds;
+  uint64_t instructions;
+  uint64_t steals;
+  std::vector<uint64_t> fingerprints;
+};
+
+static fleet_result run_fleet(const uint32_t count, const uint32_t quanta,
+                              const uint32_t quantum, const unsigned threads) {
+  std::vector<std::unique_ptr<instance>> fleet;
+  fleet.reserve(count);
+  for (uint32_t id = 0; id < count; ++id) {
+    fleet.push_back(std::make_unique<instance>(id, ROMS[id % ROMS.size()]));
+  }
+  std::vector<work_queue> queues(threads);
+  for (uint32_t id = 0; id < count; ++id) {
+    queues[id % threads].push(id);
+  }
+
+  std::atomic<uint32_t> unfinished{count};
+  std::atomic<uint64_t> steals{0};
+  auto worker = [&](const unsigned self) {
+    while (unfinished.load(std::memory_order_acquire) != 0) {
+      uint32_t id = 0;
+      bool found = queues[self].pop(id);
+      for (unsigned n = 1; !found && (n < threads); ++n) {
+        found = queues[(self + n) % threads].steal(id);
+        steals.fetch_add(found ? 1 : 0, std::memory_order_relaxed);
+      }
+      if (!found) {
+        // The rest are being run by the other workers
+        std::this_thread::yield();
+        continue;
+      }
+      instance &vm = *fleet[id];
+      vm.run_quantum(quantum);
+      if (vm.quanta_done < quanta) {
+        queues[self].push(id);
+      } else {
+        unfinished.fetch_sub(1, std::memory_order_release);
+      }
+    }
+  };
+
+  const auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (unsigned self = 1; self < threads; ++self) {
+    pool.emplace_back(worker, self);
+  }
+  worker(0);
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+
+  fleet_result result{elapsed.count(), 0, steals.load(), {}};
+  for (const auto &vm : fleet) {
+    result.instructions += vm->instructions;
+    result.fingerprints.push_back(vm->fingerprint());
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  auto arg = [argc, argv](const int index, const uint32_t fallback) {
+    return (argc > index)
+               ? static_cast<uint32_t>(std::strtoul(argv[index], nullptr, 10))
+               : fallback;
+  };
+  const uint32_t count = std::max<uint32_t>(arg(1, default_instances), 1);
+  const uint32_t quanta = std::max<uint32_t>(arg(2, default_quanta), 1);
+  const uint32_t quantum = std::max<uint32_t>(arg(3, default_quantum), 1);
+  const unsigned max_threads = std::max<unsigned>(
+      arg(4, std::thread::hardware_concurrency()), 1);
+
+  std::printf("%u instances of %zu bytes, %u quanta of %u instructions\n",
+              count, sizeof(instance), quanta, quantum);
+  std::vector<unsigned> thread_counts;
+  for (unsigned threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  bool ok = true;
+  double single = 0;
+  std::vector<uint64_t> expected;
+  for (const unsigned threads : thread_counts) {
+    const fleet_result result = run_fleet(count, quanta, quantum, threads);
+    const double rate = static_cast<double>(result.instructions) /
+                        result.seconds;
+    if (expected.empty()) {
+      expected = result.fingerprints;
+      single = rate;
+    }
+    const bool same = (result.fingerprints == expected);
+    ok = ok && same;
+    std::printf("%3u threads %12llu instructions %7.3f s %7.1f M instr/s "
+                "%5.2fx %8llu steals %s\n",
+                threads, static_cast<unsigned long long>(result.instructions),
+                result.seconds, rate / 1e6, rate / single,
+                static_cast<unsigned long long>(result.steals),
+                same ? "ok" : "FAILED");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,368 @@
+// Regression check of emulation against the frame hashes in host/golden.
+// Every bundled ROM is played for a fixed number of frames with a fixed
+// seed and a scripted key sequence, in every dispatch mode. Every
+// checkpoint_interval frames the framebuffer and the save state (CPU,
+// memory, timers, keys) are hashed, and every run has to produce exactly
+// the hashes of the golden file of its ROM. The
+// VMs run frame by frame with run_frame(), as the firmware runs them.
+// Every mode also has to count down the timers while a game waits for a
+// key and wrap the program counter and stores at the top of memory around
+// to address 0. A game resumed with code written over still has to run
+// its translation, and run it as the interpreter does.
+//
+// A change that alters emulation on purpose regenerates the files with
+// --update. The new hashes come from the reference interpreter and are
+// only written if every other mode agrees with them.
+//
+// usage: chip8_golden [--update] [golden dir]
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aot_roms.hpp"
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint32_t frames = 1800;
+static constexpr uint32_t checkpoint_interval = 60;
+static constexpr uint32_t seed = 1;
+
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+static const std::vector<std::pair<dispatch_mode, const char *>> MODES = {
+    {dispatch_mode::reference, "reference"},
+    {dispatch_mode::table, "table"},
+    {dispatch_mode::predecoded, "predecoded"},
+    {dispatch_mode::fused, "fused"},
+#ifdef CHIP8_HAS_JIT
+    {dispatch_mode::jit, "jit"},
+#endif
+    {dispatch_mode::aot, "aot"},
+};
+
+struct checkpoint {
+  uint32_t frame;
+  uint64_t display;
+  uint64_t state;
+
+  bool operator==(const checkpoint &other) const {
+    return (frame == other.frame) && (display == other.display) &&
+           (state == other.state);
+  }
+};
+using frame_hashes = std::vector<checkpoint>;
+
+// FNV-1a
+static uint64_t hash_bytes(const uint8_t *bytes, const std::size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+// Row by row, least significant byte first, so the hash does not depend on
+// the byte order of the host
+static uint64_t hash_display(const display_rows &rows) {
+  std::array<uint8_t, sizeof(display_rows)> bytes{};
+  std::size_t at = 0;
+  for (const uint64_t row : rows) {
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+      bytes[at++] = static_cast<uint8_t>(row >> shift);
+    }
+  }
+  return hash_bytes(bytes.data(), bytes.size());
+}
+
+// A press every few frames, held for a few more. Every ROM gets the same
+// sequence.
+struct key_script {
+  key_event_ring ring;
+  keyboard numpad{&ring};
+  uint32_t state{12345};
+  uint32_t release_at{0};
+  uint8_t key{0};
+
+  void next_frame(const uint32_t frame) {
+    state = (state * 1103515245U) + 12345U;
+    if ((release_at != 0) && (frame >= release_at)) {
+      static_cast<void>(ring.push(
+          {static_cast<uint8_t>(key | key_release_flag), frame}));
+      release_at = 0;
+    } else if ((release_at == 0) && (((state >> 16) % 8) == 0)) {
+      key = static_cast<uint8_t>((state >> 8) & 0xFU);
+      static_cast<void>(ring.push({key, frame}));
+      release_at = frame + 2 + ((state >> 20) % 8);
+    }
+    numpad.storeKeyPress();
+  }
+};
+
+static std::string rom_path(const std::string_view rom) {
+  return std::string{CHIP8_ROM_DIR} + '/' + std::string{rom};
+}
+
+static frame_hashes run_vm(const std::string_view rom,
+                           const dispatch_mode mode) {
+  auto script = std::make_unique<key_script>();
+  auto vm = std::make_unique<chip8>(&script->numpad);
+  vm->set_fixed_seed(seed);
+  vm->set_dispatch_mode(mode);
+  vm->load_memory(rom_path(rom));
+  if (mode == dispatch_mode::aot) {
+    vm->attach_aot(find_aot_rom(rom));
+  }
+
+  frame_hashes hashes;
+  auto state = std::make_unique<saved_state>();
+  for (uint32_t frame = 1; frame <= frames; ++frame) {
+    script->next_frame(frame);
+    // As the firmware runs it
+    static_cast<void>(vm->run_frame());
+    if ((frame % checkpoint_interval) == 0) {
+      vm->save_state(*state);
+      hashes.push_back({frame, hash_display(vm->get_display_rows()),
+                        hash_bytes(state->data(), state->size())});
+    }
+  }
+  return hashes;
+}
+
+static std::string golden_path(const std::string &dir,
+                               const std::string_view rom) {
+  return dir + '/' + std::string{rom} + ".golden";
+}
+
+// One line per checkpoint: frame, display hash, state hash. Lines starting
+// with # are comments.
+static bool read_golden(const std::string &path, frame_hashes &out) {
+  std::FILE *file = std::fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char line[128];
+  while (std::fgets(line, sizeof(line), file) != nullptr) {
+    checkpoint point{};
+    if ((line[0] != '#') &&
+        (std::sscanf(line, "%" SCNu32 " %" SCNx64 " %" SCNx64, &point.frame,
+                     &point.display, &point.state) == 3)) {
+      out.push_back(point);
+    }
+  }
+  std::fclose(file);
+  return true;
+}
+
+static bool write_golden(const std::string &path, const std::string_view rom,
+                         const frame_hashes &hashes) {
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  std::fprintf(file,
+               "# %s: %u frames, seed %u, written by chip8_golden --update\n"
+               "# frame, FNV-1a of the framebuffer, FNV-1a of the save "
+               "state\n",
+               rom.data(), frames, seed);
+  for (const checkpoint &point : hashes) {
+    std::fprintf(file, "%" PRIu32 " %016" PRIx64 " %016" PRIx64 "\n",
+                 point.frame, point.display, point.state);
+  }
+  return std::fclose(file) == 0;
+}
+
+// The timers have to run out in the 30 frames after a program sets them
+// to 30 and waits for a key nobody presses
+static bool check_key_wait_timers(const dispatch_mode mode) {
+  static const std::vector<uint8_t> program = {
+      0x6A, 0x1E, // VA = 30
+      0xFA, 0x15, // delay = VA
+      0xFA, 0x18, // sound = VA
+      0xF1, 0x0A, // wait for a key
+      0x12, 0x08, // stay here
+  };
+  keyboard numpad;
+  auto vm = std::make_unique<chip8>(&numpad);
+  vm->set_dispatch_mode(mode);
+  vm->load_memory(program);
+  run_summary frame{};
+  for (uint32_t count = 0; count < 30; ++count) {
+    frame = vm->run_frame();
+  }
+  return (frame.reason == run_stop::key_wait) && !frame.sound_active &&
+         (vm->get_delay_counter() == 0) && (vm->get_sound_counter() == 0);
+}
+
+// Resume a save state in which the instruction after the saved program
+// counter was written over. The AOT translation has to attach anyway and
+// then agree with the interpreter frame by frame.
+static bool check_aot_resume(const std::string_view rom) {
+  auto state = std::make_unique<saved_state>();
+  uint16_t pc = 0;
+  {
+    auto script = std::make_unique<key_script>();
+    auto vm = std::make_unique<chip8>(&script->numpad);
+    vm->set_fixed_seed(seed);
+    vm->load_memory(rom_path(rom));
+    for (uint32_t frame = 1; frame <= 120; ++frame) {
+      script->next_frame(frame);
+      static_cast<void>(vm->run_frame());
+    }
+    vm->save_state(*state);
+    pc = vm->get_prog_counter();
+  }
+  // Memory follows the 8 byte header, see save_state.hpp
+  (*state)[8 + ((pc + 3U) & 0x0FFFU)] ^= 0x01;
+
+  auto script = std::make_unique<std::array<key_script, 2>>();
+  auto interpreted = std::make_unique<chip8>(&(*script)[0].numpad);
+  auto translated = std::make_unique<chip8>(&(*script)[1].numpad);
+  interpreted->set_dispatch_mode(dispatch_mode::predecoded);
+  translated->set_dispatch_mode(dispatch_mode::aot);
+  interpreted->load_memory(rom_path(rom));
+  translated->load_memory(rom_path(rom));
+  if (!interpreted->load_state(*state) || !translated->load_state(*state) ||
+      !translated->attach_aot(find_aot_rom(rom))) {
+    return false;
+  }
+  auto expected = std::make_unique<saved_state>();
+  for (uint32_t frame = 121; frame <= 600; ++frame) {
+    for (key_script &each : *script) {
+      each.next_frame(frame);
+    }
+    static_cast<void>(interpreted->run_frame());
+    static_cast<void>(translated->run_frame());
+    interpreted->save_state(*expected);
+    translated->save_state(*state);
+    if (*expected != *state) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The instruction after the one at 0xFFE is the one at 0x000
+static bool check_pc_wrap(const dispatch_mode mode) {
+  std::vector<uint8_t> program(0x1000 - 0x200, 0);
+  program[0x000] = 0x1F; // 200: jump to 0xFFE
+  program[0x001] = 0xFE;
+  program[0xDFE] = 0x6A; // FFE: VA = 7
+  program[0xDFF] = 0x07;
+  // From 0x000 the font runs as code: F090 (unknown) and 9090 (no skip)
+  keyboard numpad;
+  auto vm = std::make_unique<chip8>(&numpad);
+  vm->set_dispatch_mode(mode);
+  vm->load_memory(program);
+  static_cast<void>(vm->run_cycles(4));
+  return (vm->get_V_registers()[0xA] == 7) &&
+         (vm->get_prog_counter() == 0x004);
+}
+
+// A store that runs past the end of memory goes on at address 0, and code
+// stored there runs as written
+static bool check_store_wrap(const dispatch_mode mode) {
+  static const std::vector<uint8_t> program = {
+      0xAF, 0xFE, // I = 0xFFE
+      0x60, 0x00, // V0..V5 = 00 00 6B 2A 12 12
+      0x61, 0x00, //
+      0x62, 0x6B, //
+      0x63, 0x2A, //
+      0x64, 0x12, //
+      0x65, 0x12, //
+      0xF5, 0x55, // store them at 0xFFE, 0xFFF, 0x000 ... 0x003
+      0x10, 0x00, // run 6B2A (VB = 0x2A) and 1212 from 0x000
+      0x12, 0x12, // stay here
+  };
+  keyboard numpad;
+  auto vm = std::make_unique<chip8>(&numpad);
+  vm->set_dispatch_mode(mode);
+  vm->load_memory(program);
+  static_cast<void>(vm->run_cycles(20));
+  const auto &memory = vm->get_memory_dump();
+  return (memory[0xFFE] == 0x00) && (memory[0x000] == 0x6B) &&
+         (memory[0x003] == 0x12) && (vm->get_V_registers()[0xB] == 0x2A) &&
+         (vm->get_prog_counter() == 0x212);
+}
+
+// Where a run first leaves the golden hashes, or "" if it never does
+static std::string first_difference(const frame_hashes &golden,
+                                    const frame_hashes &run) {
+  for (std::size_t i = 0; i < golden.size(); ++i) {
+    if ((i >= run.size()) || !(run[i] == golden[i])) {
+      const bool display = (i < run.size()) &&
+                           (run[i].display != golden[i].display);
+      return "frame " + std::to_string(golden[i].frame) +
+             (display ? " (display)" : " (state)");
+    }
+  }
+  return (run.size() == golden.size()) ? "" : "extra checkpoints";
+}
+
+int main(int argc, char **argv) {
+  bool update = false;
+  std::string dir = CHIP8_GOLDEN_DIR;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--update") == 0) {
+      update = true;
+    } else {
+      dir = argv[i];
+    }
+  }
+
+  bool ok = true;
+  for (const auto &[mode, name] : MODES) {
+    const bool counted = check_key_wait_timers(mode);
+    const bool wrapped = check_store_wrap(mode);
+    const bool pc_wrapped = check_pc_wrap(mode);
+    ok = ok && counted && wrapped && pc_wrapped;
+    std::printf("%-16s %-10s %s\n", "key wait timers", name,
+                counted ? "ok" : "FAILED");
+    std::printf("%-16s %-10s %s\n", "store wrap", name,
+                wrapped ? "ok" : "FAILED");
+    std::printf("%-16s %-10s %s\n", "pc wrap", name,
+                pc_wrapped ? "ok" : "FAILED");
+  }
+  for (const auto rom : ROMS) {
+    const bool resumed = check_aot_resume(rom);
+    ok = ok && resumed;
+    std::printf("%-16s %-10s %s\n", rom.data(), "aot resume",
+                resumed ? "ok" : "FAILED");
+  }
+  for (const auto rom : ROMS) {
+    const std::string path = golden_path(dir, rom);
+    frame_hashes golden;
+    if (update) {
+      golden = run_vm(rom, dispatch_mode::reference);
+    } else if (!read_golden(path, golden) || golden.empty()) {
+      std::printf("%-16s no golden hashes in %s\n", rom.data(), path.c_str());
+      ok = false;
+      continue;
+    }
+
+    bool rom_ok = true;
+    auto report = [&](const char *name, const frame_hashes &run) {
+      const std::string difference = first_difference(golden, run);
+      rom_ok = rom_ok && difference.empty();
+      std::printf("%-16s %-10s %s%s\n", rom.data(), name,
+                  difference.empty() ? "ok" : "FAILED at ",
+                  difference.c_str());
+    };
+    for (const auto &[mode, name] : MODES) {
+      report(name, run_vm(rom, mode));
+    }
+
+    if (update && rom_ok && !write_golden(path, rom, golden)) {
+      std::printf("%-16s could not write %s\n", rom.data(), path.c_str());
+      rom_ok = false;
+    }
+    ok = ok && rom_ok;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
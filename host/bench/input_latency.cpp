@@ -0,0 +1,165 @@
+// Input latency on a fake clock. A scripted event source stands in for
+// the BLE numpad and stamps its events with a clock the test controls,
+// so every latency the keyboard records is known in advance.
+//
+// The first part checks the key model and the histogram against exact
+// expectations. The second part plays pong, pressing and releasing the
+// paddle keys at pseudo random times, with the clock advancing by one
+// instruction's share of a 60 Hz frame per instruction. It prints the
+// distribution from arrival to the first EX9E/EXA1 that saw the key.
+//
+// usage: chip8_input [frames] [cycles_per_frame]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint32_t default_frames = 36000;
+static constexpr uint32_t frame_us = 1000000 / 60;
+
+static uint32_t fake_now = 0;
+static uint32_t fake_clock() { return fake_now; }
+
+static bool check(const bool condition, const char *what) {
+  if (!condition) {
+    std::printf("FAILED: %s\n", what);
+  }
+  return condition;
+}
+
+static bool check_key_model() {
+  key_event_ring ring;
+  keyboard numpad{&ring, fake_clock};
+  bool ok = true;
+
+  // Before the client has sent a release, a press is down from the frame
+  // it arrives in until key_hold_frames have passed. Draining the events
+  // more often does not shorten it.
+  fake_now = 1000;
+  static_cast<void>(ring.push({0x5, 1000}));
+  fake_now = 1250;
+  numpad.storeKeyPress();
+  ok &= check(numpad.isKeyVxPressed(0x5), "first press is seen");
+  ok &= check(numpad.isKeyVxPressed(0x5), "first press is held");
+  ok &= check(numpad.inputLatency().count() == 1, "one latency sample");
+  ok &= check(numpad.inputLatency().max() == 250, "latency is 250 us");
+  for (uint32_t frame = 1; frame < keyboard::key_hold_frames; ++frame) {
+    numpad.storeKeyPress();
+    numpad.storeKeyPress();
+    numpad.endFrame();
+  }
+  ok &= check(numpad.isKeyVxPressed(0x5), "first press is held until timeout");
+  numpad.endFrame();
+  ok &= check(!numpad.isKeyVxPressed(0x5), "unreleased press times out");
+
+  // Once releases arrive, a key stays down until its release
+  static_cast<void>(ring.push({0x5 | key_release_flag, 1300}));
+  static_cast<void>(ring.push({0x2, 1400}));
+  static_cast<void>(ring.push({0x7, 1400}));
+  fake_now = 2400;
+  numpad.storeKeyPress();
+  ok &= check(numpad.pressedKeys() == ((1U << 0x2) | (1U << 0x7)),
+              "two keys down at once");
+  ok &= check(numpad.isKeyVxPressed(0x7), "held key is seen");
+  ok &= check(numpad.isKeyVxPressed(0x7), "held key is seen again");
+  ok &= check(numpad.inputLatency().count() == 2,
+              "a held key is measured once");
+  ok &= check(numpad.whichKeyIndexIfPressed() == 0x2,
+              "FX0A gets the unseen press");
+  ok &= check(!numpad.whichKeyIndexIfPressed(),
+              "FX0A does not see a held key twice");
+  static_cast<void>(ring.push({0x7 | key_release_flag, 2500}));
+  numpad.storeKeyPress();
+  ok &= check(!numpad.isKeyVxPressed(0x7), "released key is up");
+
+  // A tap shorter than a frame is still seen once
+  static_cast<void>(ring.push({0x9, 3000}));
+  static_cast<void>(ring.push({0x9 | key_release_flag, 3100}));
+  numpad.storeKeyPress();
+  ok &= check(numpad.isKeyVxPressed(0x9), "short tap is seen");
+  ok &= check(!numpad.isKeyVxPressed(0x9), "short tap is seen once");
+  return ok;
+}
+
+static bool check_histogram() {
+  latency_histogram histogram;
+  bool ok = check(histogram.p50() == 0, "empty histogram");
+  for (uint32_t us = 1; us <= 100000; ++us) {
+    histogram.record(us);
+  }
+  const uint32_t p50 = histogram.p50();
+  const uint32_t p99 = histogram.p99();
+  ok &= check((p50 >= 50000) && (p50 <= 50000 + 50000 / 8), "p50 of 1..1e5");
+  ok &= check((p99 >= 99000) && (p99 <= 100000), "p99 of 1..1e5");
+  ok &= check(histogram.max() == 100000, "max of 1..1e5");
+  histogram.clear();
+  histogram.record(7);
+  ok &= check(histogram.percentile(0.0) == 7 && histogram.p99() == 7,
+              "small values are exact");
+  return ok;
+}
+
+// Pong's left paddle keys
+static constexpr uint8_t keys[] = {0x1, 0x4};
+
+int main(int argc, char **argv) {
+  const uint32_t frames =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_frames;
+  const bool ok = check_key_model() && check_histogram();
+
+  key_event_ring ring;
+  keyboard numpad{&ring, fake_clock};
+  chip8 emulator{&numpad};
+  std::string path = CHIP8_ROM_DIR;
+  path += "/pong.ch8";
+  emulator.load_memory(path);
+  if (argc > 2) {
+    emulator.set_cycles_per_frame(
+        static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)));
+  }
+  const uint32_t cycles_per_frame = emulator.get_cycles_per_frame();
+  const uint32_t instruction_us = frame_us / cycles_per_frame;
+
+  // Next event at a pseudo random time, alternating press and release
+  uint32_t seed = 12345;
+  auto next_gap = [&seed] {
+    seed = (seed * 1103515245U) + 12345U;
+    return 20000 + ((seed >> 8) % 200000);
+  };
+  fake_now = 0;
+  uint32_t next_event = next_gap();
+  bool down = false;
+  uint8_t key = keys[0];
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    numpad.storeKeyPress();
+    for (uint32_t i = 0; i < cycles_per_frame; ++i) {
+      static_cast<void>(emulator.run_cycles(1));
+      fake_now += instruction_us;
+      // The event source runs concurrently with the emulator
+      while (fake_now >= next_event) {
+        if (!down) {
+          key = keys[(seed >> 4) & 1U];
+        }
+        const auto code =
+            static_cast<uint8_t>(down ? (key | key_release_flag) : key);
+        static_cast<void>(ring.push({code, next_event}));
+        down = !down;
+        next_event += next_gap();
+      }
+    }
+    fake_now += frame_us - (cycles_per_frame * instruction_us);
+    // What run_frame() does once the frame's instructions ran
+    numpad.endFrame();
+  }
+
+  const latency_histogram &latency = numpad.inputLatency();
+  std::printf("pong, %u frames at %u instructions each: %u presses seen, "
+              "p50 %u us, p99 %u us, max %u us\n",
+              frames, cycles_per_frame, latency.count(), latency.p50(),
+              latency.p99(), latency.max());
+  std::printf("key model and histogram checks %s\n", ok ? "ok" : "FAILED");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,123 @@
+// Hammers spsc_ring from two threads. The producer pushes a running
+// sequence number, the consumer checks that what comes out is strictly
+// increasing. In the lossless round the producer yields and retries when
+// the ring is full, so everything has to arrive; in the lossy round it
+// moves on and every gap has to be accounted for by the drop counter.
+// A last round pushes key values into a key_event_ring and drains them
+// through keyboard::storeKeyPress() in frame sized batches, the way the
+// firmware does.
+//
+// usage: chip8_keys [events]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "keyboard.hpp"
+#include "spsc_ring.hpp"
+
+static constexpr uint32_t default_events = 10'000'000;
+
+static bool stress_sequence(const uint32_t events, const bool lossless) {
+  spsc_ring<uint32_t, 32> ring;
+  std::atomic<bool> done{false};
+  uint64_t received = 0;
+  uint64_t gaps = 0;
+  bool ordered = true;
+
+  const auto start = std::chrono::steady_clock::now();
+  std::thread consumer{[&] {
+    uint32_t expected = 0;
+    uint32_t value = 0;
+    while (true) {
+      const bool last = done.load(std::memory_order_acquire);
+      if (!ring.pop(value)) {
+        if (last) {
+          break;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      if (value < expected) {
+        ordered = false;
+      }
+      gaps += value - expected;
+      expected = value + 1;
+      ++received;
+    }
+    gaps += events - expected;
+  }};
+  for (uint32_t i = 0; i < events; ++i) {
+    while (!ring.push(i) && lossless) {
+      std::this_thread::yield();
+    }
+  }
+  done.store(true, std::memory_order_release);
+  consumer.join();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  // A retried push counts as dropped too, but nothing may go missing
+  const bool ok =
+      ordered && (lossless ? ((received == events) && (gaps == 0))
+                           : (((received + ring.dropped_count()) == events) &&
+                              (gaps == ring.dropped_count())));
+  std::printf("%-8s: %u pushed, %llu received, %u dropped in %.3f s "
+              "(%.1f M events/s) %s\n",
+              lossless ? "lossless" : "lossy", events,
+              static_cast<unsigned long long>(received),
+              ring.dropped_count(), elapsed.count(),
+              events / elapsed.count() / 1e6, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool stress_keyboard(const uint32_t events) {
+  key_event_ring ring;
+  keyboard numpad{&ring};
+  std::atomic<bool> done{false};
+  uint64_t seen = 0;
+
+  std::thread producer{[&] {
+    for (uint32_t i = 0; i < events; ++i) {
+      if (!ring.push({static_cast<uint8_t>(i & 0xFU), 0})) {
+        std::this_thread::yield();
+      }
+    }
+    done.store(true, std::memory_order_release);
+  }};
+  // One drain per frame, then the game looks at the keys
+  while (true) {
+    const bool last = done.load(std::memory_order_acquire);
+    numpad.storeKeyPress();
+    while (numpad.whichKeyIndexIfPressed()) {
+      ++seen;
+    }
+    if (last) {
+      numpad.storeKeyPress();
+      while (numpad.whichKeyIndexIfPressed()) {
+        ++seen;
+      }
+      break;
+    }
+    std::this_thread::yield();
+  }
+  producer.join();
+
+  // Presses of a key that is already down collapse into one
+  const bool ok = (seen != 0) && (seen <= events - numpad.droppedKeyEvents());
+  std::printf("keyboard: %u pushed, %u dropped, %llu distinct presses seen "
+              "%s\n",
+              events, numpad.droppedKeyEvents(),
+              static_cast<unsigned long long>(seen), ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  const uint32_t events =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_events;
+  const bool ok = stress_sequence(events, true) &&
+                  stress_sequence(events, false) && stress_keyboard(events);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,92 @@
+// Counts which pairs of opcodes execute back to back on the bundled ROMs.
+// Only fall-through pairs (the second instruction directly follows the
+// first in memory) are counted, as those are the ones that can be fused
+// into the superinstructions of dispatch_mode::fused.
+//
+// usage: chip8_pairs [cycles]
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint64_t default_cycles = 2'000'000;
+static constexpr std::size_t top_pairs = 15;
+static const std::vector<std::string_view> ROMS = {"pong.ch8", "invaders.ch8",
+                                                   "tetris.ch8"};
+
+using pair_counts = std::array<uint64_t, opcode_id_count * opcode_id_count>;
+
+static void profile_rom(std::string_view rom, uint64_t cycles,
+                        pair_counts &counts) {
+  keyboard numpad;
+  chip8 emulator{&numpad};
+  emulator.set_dispatch_mode(dispatch_mode::reference);
+  std::string path = CHIP8_ROM_DIR;
+  path += '/';
+  path += rom;
+  emulator.load_memory(path);
+
+  const auto &memory = emulator.get_memory_dump();
+  std::size_t previous = opcode_id_count;
+  uint16_t previous_pc = 0;
+  for (uint64_t i = 0; i < cycles; ++i) {
+    const uint16_t pc = emulator.get_prog_counter();
+    const auto id =
+        decode(static_cast<uint16_t>((memory[pc] << 8) | memory[pc + 1])).id;
+    const auto current = static_cast<std::size_t>(id);
+    if ((previous != opcode_id_count) && (pc == (previous_pc + 2))) {
+      ++counts[(previous * opcode_id_count) + current];
+    }
+    previous = current;
+    previous_pc = pc;
+    emulator.step_one_cycle();
+  }
+}
+
+static void print_top(const char *title, const pair_counts &counts) {
+  std::vector<std::size_t> order(counts.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&counts](auto a, auto b) {
+    return counts[a] > counts[b];
+  });
+  uint64_t total = 0;
+  for (const auto count : counts) {
+    total += count;
+  }
+
+  std::printf("%s\n", title);
+  for (std::size_t i = 0; (i < top_pairs) && counts[order[i]]; ++i) {
+    const auto first = order[i] / opcode_id_count;
+    const auto second = order[i] % opcode_id_count;
+    std::printf("  %-4s -> %-4s %12llu %6.2f%%\n", opcode_names[first],
+                opcode_names[second],
+                static_cast<unsigned long long>(counts[order[i]]),
+                100.0 * static_cast<double>(counts[order[i]]) /
+                    static_cast<double>(total));
+  }
+}
+
+int main(int argc, char **argv) {
+  const uint64_t cycles =
+      (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : default_cycles;
+
+  pair_counts all{};
+  for (const auto rom : ROMS) {
+    pair_counts counts{};
+    profile_rom(rom, cycles, counts);
+    print_top(rom.data(), counts);
+    for (std::size_t i = 0; i < all.size(); ++i) {
+      all[i] += counts[i];
+    }
+  }
+  print_top("all", all);
+  return 0;
+}
@@ -0,0 +1,156 @@
+// Runs the emulator and the renderer on two threads connected by the
+// frame_mailbox, the same way the firmware splits them over the two
+// cores. The emulator spends frame_ns on every frame (0 runs it flat
+// out); the renderer draws through the line buffer renderer into a
+// counting bus and then stalls for as long as the bytes would take on the
+// SPI bus, so it falls behind now and then and frames get dropped.
+//
+// Every frame the renderer takes is checked: a panel that is only
+// updated inside the delivered damage has to match the frame exactly. A
+// mismatch means the damage of a dropped frame was lost.
+//
+// usage: chip8_pipeline [frames] [ns_per_byte] [frame_ns]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+#include "line_renderer.hpp"
+#include "triple_buffer.hpp"
+
+static constexpr uint32_t default_frames = 20000;
+// 40 MHz SPI
+static constexpr uint32_t default_ns_per_byte = 200;
+// Fast enough to outrun the renderer on the busier frames
+static constexpr uint32_t default_frame_ns = 20000;
+static constexpr int scale = 4;
+static constexpr panel_geometry geometry{scale, 120 + ((scale / 2) * 32),
+                                         160 - ((scale / 2) * 64),
+                                         panel_rotation::quarter_turn};
+static const std::vector<std::string_view> ROMS = {"pong.ch8", "invaders.ch8",
+                                                   "tetris.ch8"};
+
+struct counting_bus {
+  uint64_t bytes{0};
+
+  void set_window(int /*x0*/, int /*y0*/, int /*x1*/, int /*y1*/) {
+    bytes += 11;
+  }
+  void push(const void * /*data*/, const std::size_t count) { bytes += count; }
+  void end_window() {}
+};
+
+static void spin(const std::chrono::nanoseconds duration) {
+  const auto until = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < until) {
+  }
+}
+
+struct consumer_stats {
+  uint32_t taken{0};
+  uint32_t mismatches{0};
+  uint64_t bytes{0};
+};
+
+static void consume(frame_mailbox &frames, const std::atomic<bool> &done,
+                    const uint32_t ns_per_byte, display_rows &panel,
+                    consumer_stats &stats) {
+  static std::array<rgb565, 2 * display_x * scale * scale> line_buffer;
+  counting_bus bus;
+  line_renderer<rgb565, counting_bus> renderer{
+      bus,           geometry, line_buffer.data(), line_buffer.size(),
+      make_rgb565(0, 255, 0), make_rgb565(0, 0, 0)};
+  while (true) {
+    // Read done first so a frame published right before it is not missed
+    const bool last = done.load(std::memory_order_acquire);
+    const display_frame *frame = frames.take();
+    if (frame == nullptr) {
+      if (last) {
+        break;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    ++stats.taken;
+
+    const uint64_t columns = frame->damage.column_mask();
+    for (std::size_t y = 0; y < display_y; ++y) {
+      if ((frame->damage.rows >> y) & 1U) {
+        panel[y] = (panel[y] & ~columns) | (frame->rows[y] & columns);
+      }
+    }
+    if (panel != frame->rows) {
+      ++stats.mismatches;
+      panel = frame->rows;
+    }
+
+    const uint64_t before = bus.bytes;
+    renderer.draw(frame->rows, frame->damage);
+    spin(std::chrono::nanoseconds((bus.bytes - before) * ns_per_byte));
+  }
+  stats.bytes = bus.bytes;
+}
+
+int main(int argc, char **argv) {
+  const uint32_t frame_count =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_frames;
+  const uint32_t ns_per_byte =
+      (argc > 2) ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10))
+                 : default_ns_per_byte;
+  const auto frame_time = std::chrono::nanoseconds(
+      (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : default_frame_ns);
+
+  bool ok = true;
+  for (const auto rom : ROMS) {
+    keyboard numpad;
+    chip8 emulator{&numpad};
+    emulator.set_dispatch_mode(dispatch_mode::predecoded);
+    std::string path = CHIP8_ROM_DIR;
+    path += '/';
+    path += rom;
+    emulator.load_memory(path);
+
+    frame_mailbox frames;
+    std::atomic<bool> done{false};
+    display_rows panel{0};
+    consumer_stats stats;
+    std::thread renderer{consume, std::ref(frames), std::cref(done),
+                         ns_per_byte, std::ref(panel), std::ref(stats)};
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < frame_count; ++frame) {
+      const auto frame_end = std::chrono::steady_clock::now() + frame_time;
+      if (emulator.run_frame().display_changed) {
+        frames.publish(emulator.get_display_rows(),
+                       emulator.take_display_damage());
+      }
+      spin(frame_end - std::chrono::steady_clock::now());
+    }
+    const auto emulated = std::chrono::steady_clock::now();
+    done.store(true, std::memory_order_release);
+    renderer.join();
+    const auto drained = std::chrono::steady_clock::now();
+
+    const bool final_ok = panel == emulator.get_display_rows();
+    ok = ok && final_ok && (stats.mismatches == 0);
+    const std::chrono::duration<double> emulate_time = emulated - start;
+    const std::chrono::duration<double> total_time = drained - start;
+    std::printf("%s: %u frames in %.3f s (%.0f frames/s), drained after "
+                "%.3f s\n",
+                rom.data(), frame_count, emulate_time.count(),
+                frame_count / emulate_time.count(), total_time.count());
+    std::printf("  published %u, dropped %u, drawn %u, %llu SPI bytes, "
+                "%u mismatches, final frame %s\n",
+                frames.published_count(), frames.dropped_count(), stats.taken,
+                static_cast<unsigned long long>(stats.bytes), stats.mismatches,
+                final_ok ? "matches" : "DIFFERS");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,186 @@
+// Hot spot report from the VM profiler (CONFIG_CHIP8_PROFILER). Either
+// profiles one of the bundled ROMs itself, or reads a dump the firmware
+// printed to the console together with the ROM it came from.
+//
+// The report lists the opcodes by how often they ran, the hottest spans
+// of consecutively executed addresses (in practice the inner loops) and
+// the hottest single addresses.
+//
+// usage: chip8_profile [--dump] [rom] [cycles]
+//        chip8_profile --report <dump file> <rom file>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint64_t default_cycles = 2'000'000;
+static constexpr std::size_t top_spans = 10;
+static constexpr std::size_t top_addresses = 20;
+
+using guest_memory = std::array<uint8_t, 4096>;
+
+// Addresses executed one after the other without a gap
+struct span {
+  uint16_t first;
+  uint16_t last;
+  uint64_t hits;
+  uint16_t hottest;
+};
+
+static double share(const uint64_t count, const uint32_t total) {
+  return (total != 0) ? 100.0 * static_cast<double>(count) / total : 0.0;
+}
+
+static uint16_t opcode_at(const guest_memory &memory, const uint16_t pc) {
+  return static_cast<uint16_t>((memory[pc] << 8) | memory[(pc + 1) & 0xFFF]);
+}
+
+static void print_report(const vm_profile &profile,
+                         const guest_memory &memory) {
+  const uint32_t total = profile.total();
+  std::printf("%u instructions\n\nopcodes\n", total);
+  std::vector<std::size_t> ids(opcode_id_count);
+  for (std::size_t id = 0; id < ids.size(); ++id) {
+    ids[id] = id;
+  }
+  auto count_of = [&profile](const std::size_t id) {
+    return profile.opcode_count(static_cast<opcode_id>(id));
+  };
+  std::sort(ids.begin(), ids.end(), [&count_of](auto a, auto b) {
+    return count_of(a) > count_of(b);
+  });
+  for (const auto id : ids) {
+    if (count_of(id) != 0) {
+      std::printf("  %-7s %12u %6.2f%%\n", opcode_names[id], count_of(id),
+                  share(count_of(id), total));
+    }
+  }
+
+  std::vector<span> spans;
+  for (uint16_t pc = 0; pc < vm_profile::address_count; ++pc) {
+    const uint32_t hits = profile.pc_hits(pc);
+    if (hits == 0) {
+      continue;
+    }
+    if (spans.empty() || (pc != spans.back().last + 2)) {
+      spans.push_back({pc, pc, 0, pc});
+    }
+    span &current = spans.back();
+    current.last = pc;
+    current.hits += hits;
+    if (hits > profile.pc_hits(current.hottest)) {
+      current.hottest = pc;
+    }
+  }
+  std::sort(spans.begin(), spans.end(),
+            [](const span &a, const span &b) { return a.hits > b.hits; });
+  std::printf("\nhot spans\n");
+  for (std::size_t i = 0; (i < top_spans) && (i < spans.size()); ++i) {
+    const span &entry = spans[i];
+    std::printf("  %03x-%03x %12llu %6.2f%%  hottest %03x\n", entry.first,
+                entry.last, static_cast<unsigned long long>(entry.hits),
+                share(entry.hits, total), entry.hottest);
+  }
+
+  std::vector<uint16_t> addresses;
+  for (uint16_t pc = 0; pc < vm_profile::address_count; ++pc) {
+    if (profile.pc_hits(pc) != 0) {
+      addresses.push_back(pc);
+    }
+  }
+  std::sort(addresses.begin(), addresses.end(), [&profile](auto a, auto b) {
+    return profile.pc_hits(a) > profile.pc_hits(b);
+  });
+  std::printf("\nhot addresses\n");
+  for (std::size_t i = 0; (i < top_addresses) && (i < addresses.size());
+       ++i) {
+    const uint16_t pc = addresses[i];
+    const uint16_t opcode = opcode_at(memory, pc);
+    std::printf("  %03x %04x %-7s %12u %6.2f%%\n", pc, opcode,
+                opcode_names[static_cast<std::size_t>(decode(opcode).id)],
+                profile.pc_hits(pc), share(profile.pc_hits(pc), total));
+  }
+}
+
+static bool read_rom(const char *path, guest_memory &memory) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    std::fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+  const std::vector<char> rom{std::istreambuf_iterator<char>{file}, {}};
+  std::copy_n(rom.begin(), std::min<std::size_t>(rom.size(), 4096 - 512),
+              memory.begin() + 512);
+  return true;
+}
+
+static int report_dump(const char *dump_path, const char *rom_path) {
+  std::FILE *dump = std::fopen(dump_path, "r");
+  if (!dump) {
+    std::fprintf(stderr, "cannot open %s\n", dump_path);
+    return EXIT_FAILURE;
+  }
+  // Console logs around the dump are skipped
+  static vm_profile profile;
+  char line[128];
+  while (std::fgets(line, sizeof(line), dump)) {
+    static_cast<void>(profile.parse_line(line));
+  }
+  std::fclose(dump);
+
+  guest_memory memory{};
+  if (!read_rom(rom_path, memory)) {
+    return EXIT_FAILURE;
+  }
+  print_report(profile, memory);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+  if ((argc > 1) && (std::strcmp(argv[1], "--report") == 0)) {
+    if (argc != 4) {
+      std::fprintf(stderr, "usage: chip8_profile --report <dump> <rom>\n");
+      return EXIT_FAILURE;
+    }
+    return report_dump(argv[2], argv[3]);
+  }
+
+  int arg = 1;
+  const bool dump = (argc > arg) && (std::strcmp(argv[arg], "--dump") == 0);
+  arg += dump ? 1 : 0;
+  const std::string rom = (argc > arg) ? argv[arg++] : "pong.ch8";
+  const uint64_t cycles =
+      (argc > arg) ? std::strtoull(argv[arg], nullptr, 10) : default_cycles;
+
+  keyboard numpad;
+  chip8 emulator{&numpad};
+  emulator.set_fixed_seed(1);
+  emulator.load_memory(std::string{CHIP8_ROM_DIR} + '/' + rom);
+  for (uint64_t done = 0; done < cycles;) {
+    const auto batch = emulator.run_cycles(
+        static_cast<uint32_t>(std::min<uint64_t>(cycles - done, 100'000)));
+    done += batch.cycles;
+    // Nobody presses keys here, so a game waiting for one is done
+    if (batch.reason == run_stop::key_wait) {
+      break;
+    }
+  }
+
+  static vm_profile profile;
+  emulator.get_profile(profile);
+  if (dump) {
+    profile.dump(stdout);
+  } else {
+    std::printf("%s\n", rom.c_str());
+    print_report(profile, emulator.get_memory_dump());
+  }
+  return EXIT_SUCCESS;
+}
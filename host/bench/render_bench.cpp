@@ -0,0 +1,133 @@
+// Measures what redrawing the screen costs on the SPI bus. Every ROM runs
+// for a number of frames the way the firmware does (run_frame(), redraw
+// if the display changed) and the damage is drawn both by the line
+// buffer renderer and by the previous path, which issued a TFT_fillRect
+// for every run of changed pixels. A counting bus stands in for the
+// panel.
+//
+// Bytes are what goes over the wire: 11 for an address window (CASET and
+// PASET with four parameter bytes each, RAMWR) plus two per pixel.
+// Transactions count one per command of the address window and one per
+// pixel push.
+//
+// usage: chip8_render [frames]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+#include "line_renderer.hpp"
+
+static constexpr uint32_t default_frames = 3000;
+static constexpr int scale = 4;
+// Same placement as components/DISP on the 240x320 panel
+static constexpr panel_geometry geometry{scale, 120 + ((scale / 2) * 32),
+                                         160 - ((scale / 2) * 64),
+                                         panel_rotation::quarter_turn};
+static constexpr std::size_t window_bytes = 11;
+static constexpr std::size_t window_transactions = 3;
+static const std::vector<std::string_view> ROMS = {
+    "pong.ch8", "invaders.ch8", "tetris.ch8", "test_opcode.ch8"};
+
+struct counting_bus {
+  uint64_t bytes{0};
+  uint64_t transactions{0};
+  uint64_t windows{0};
+
+  void set_window(int /*x0*/, int /*y0*/, int /*x1*/, int /*y1*/) {
+    bytes += window_bytes;
+    transactions += window_transactions;
+    ++windows;
+  }
+  void push(const void * /*data*/, const std::size_t count) {
+    bytes += count;
+    ++transactions;
+  }
+  void end_window() {}
+};
+
+// The previous TFTDisp::drawGfx: one filled rectangle per run of changed
+// pixels in a row
+class rect_renderer {
+public:
+  explicit rect_renderer(counting_bus &bus) : bus{bus} {}
+
+  void draw(const display_rows &rows, const display_damage &damage) {
+    const uint64_t columns = damage.column_mask();
+    for (uint32_t dirty = damage.rows; dirty != 0; dirty &= dirty - 1U) {
+      const auto y = static_cast<uint>(__builtin_ctz(dirty));
+      const uint64_t changed = (rows[y] ^ shown[y]) & columns;
+      for (uint64_t run_bits : {changed & rows[y], changed & ~rows[y]}) {
+        while (run_bits) {
+          const auto x = static_cast<uint>(__builtin_clzll(run_bits));
+          const uint64_t rest = ~(run_bits << x);
+          const uint length = rest ? static_cast<uint>(__builtin_clzll(rest))
+                                   : display_x - x;
+          const uint64_t run =
+              (length == display_x)
+                  ? UINT64_MAX
+                  : ((uint64_t{1} << length) - 1U) << (display_x - x - length);
+          run_bits &= ~run;
+          bus.set_window(0, 0, scale - 1, (scale * length) - 1);
+          bus.push(nullptr, 2U * scale * scale * length);
+        }
+      }
+      shown[y] ^= changed;
+    }
+  }
+
+private:
+  counting_bus &bus;
+  display_rows shown{0};
+};
+
+static void print_row(const char *path, const counting_bus &bus,
+                      const uint32_t drawn) {
+  const double frames = (drawn != 0) ? drawn : 1;
+  std::printf("  %-6s %10.1f B/frame %8.1f transactions/frame "
+              "%8.1f windows/frame\n",
+              path, static_cast<double>(bus.bytes) / frames,
+              static_cast<double>(bus.transactions) / frames,
+              static_cast<double>(bus.windows) / frames);
+}
+
+int main(int argc, char **argv) {
+  const uint32_t frames =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_frames;
+
+  static std::array<rgb565, 2 * display_x * scale * scale> line_buffer;
+  for (const auto rom : ROMS) {
+    keyboard numpad;
+    chip8 emulator{&numpad};
+    emulator.set_dispatch_mode(dispatch_mode::predecoded);
+    std::string path = CHIP8_ROM_DIR;
+    path += '/';
+    path += rom;
+    emulator.load_memory(path);
+
+    counting_bus line_bus;
+    counting_bus rect_bus;
+    line_renderer<rgb565, counting_bus> lines{
+        line_bus,           geometry,
+        line_buffer.data(), line_buffer.size(),
+        make_rgb565(0, 255, 0), make_rgb565(0, 0, 0)};
+    rect_renderer rects{rect_bus};
+    uint32_t drawn = 0;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      if (emulator.run_frame().display_changed) {
+        const auto damage = emulator.take_display_damage();
+        lines.draw(emulator.get_display_rows(), damage);
+        rects.draw(emulator.get_display_rows(), damage);
+        ++drawn;
+      }
+    }
+    std::printf("%s: %u of %u frames redrawn\n", rom.data(), drawn, frames);
+    print_row("rects", rect_bus, drawn);
+    print_row("lines", line_bus, drawn);
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+// Memory use and capture cost of the rewind history (CONFIG_CHIP8_REWIND)
+// with the firmware's default budget. Every bundled ROM is played for a
+// number of frames with random key presses. A ring of the same size is
+// fed the same states on the side to time a capture on its own and to
+// find the fewest frames the history held once it was full. At the
+// end the VM rewinds through everything it kept, and every frame it lands
+// on has to match the state saved right after that frame ran.
+//
+// usage: chip8_rewind [frames]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint32_t default_frames = 3600;
+
+using history_ring = rewind_ring_within<CONFIG_CHIP8_REWIND_BYTES,
+                                        CONFIG_CHIP8_REWIND_KEYFRAME_INTERVAL>;
+
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+
+int main(int argc, char **argv) {
+  const uint32_t frames =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_frames;
+
+  std::printf("%u bytes of history (%zu of records), a keyframe every %u "
+              "frames\n",
+              CONFIG_CHIP8_REWIND_BYTES, history_ring::capacity(),
+              CONFIG_CHIP8_REWIND_KEYFRAME_INTERVAL);
+  bool ok = true;
+  for (const auto rom : ROMS) {
+    key_event_ring ring;
+    keyboard numpad{&ring};
+    auto emulator = std::make_unique<chip8>(&numpad);
+    emulator->set_fixed_seed(1);
+    emulator->load_memory(std::string{CHIP8_ROM_DIR} + '/' + std::string{rom});
+
+    auto probe = std::make_unique<history_ring>();
+    auto latest = std::make_unique<saved_state>();
+    std::vector<saved_state> played(frames);
+    uint32_t seed = 12345;
+    uint32_t release_at = 0;
+    uint8_t key = 0;
+    double capture_ns = 0;
+    double slowest_ns = 0;
+    // Frames the probe could go back after each capture, from the first
+    // capture that made it drop old records
+    uint32_t fewest = 0;
+    bool full = false;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      // A press every few frames, held for a few more
+      seed = (seed * 1103515245U) + 12345U;
+      if ((release_at != 0) && (frame >= release_at)) {
+        static_cast<void>(ring.push(
+            {static_cast<uint8_t>(key | key_release_flag), frame}));
+        release_at = 0;
+      } else if ((release_at == 0) && (((seed >> 16) % 8) == 0)) {
+        key = static_cast<uint8_t>((seed >> 8) & 0xFU);
+        static_cast<void>(ring.push({key, frame}));
+        release_at = frame + 2 + ((seed >> 20) % 8);
+      }
+      numpad.storeKeyPress();
+      static_cast<void>(emulator->run_frame());
+
+      // What run_frame() does after the frame, into memory that is warm
+      const auto begin = std::chrono::steady_clock::now();
+      emulator->save_state(*latest);
+      probe->capture(*latest);
+      const std::chrono::duration<double, std::nano> took =
+          std::chrono::steady_clock::now() - begin;
+      played[frame] = *latest;
+      const uint32_t kept = probe->frames();
+      full = full || ((frame != 0) && (kept != frame));
+      fewest = (full && ((fewest == 0) || (kept < fewest))) ? kept : fewest;
+      capture_ns += took.count();
+      slowest_ns = std::max(slowest_ns, took.count());
+    }
+
+    const uint32_t held = emulator->get_rewind_frames();
+    const std::size_t used = probe->used();
+    const uint32_t keyframes = probe->keyframes();
+    bool same = (held == probe->frames()) && (held != 0);
+    // One long jump, then back through the rest a frame at a time
+    uint32_t newest = frames - 1;
+    auto check = [&](const uint32_t back) {
+      same = same && (emulator->rewind(back) == back);
+      newest -= back;
+      saved_state now;
+      emulator->save_state(now);
+      same = same && (now == played[newest]);
+    };
+    check(held / 2);
+    while (emulator->get_rewind_frames() != 0) {
+      check(1);
+    }
+    same = same && (newest == frames - 1 - held) &&
+           (emulator->rewind(1) == 0);
+    ok = ok && same;
+
+    fewest = full ? fewest : held;
+    std::printf("%-16s %5u frames kept (%5.1f s, never under %5.1f s), "
+                "%3u keyframes, %6zu bytes, %5.0f bytes/frame, capture %5.0f "
+                "ns avg %6.0f ns max %s\n",
+                rom.data(), held + 1, (held + 1) / 60.0, (fewest + 1) / 60.0,
+                keyframes, used,
+                static_cast<double>(used) / (held + 1), capture_ns / frames,
+                slowest_ns, same ? "ok" : "FAILED");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,126 @@
+// Round trip check and timing for chip8::save_state()/load_state(). Every
+// bundled ROM runs for a while in every dispatch mode and is saved. The
+// run then continues for a number of frames, once on the same VM, once on
+// the same VM after restoring the save and once on a fresh VM the save was
+// loaded into. All three have to end in the same state. Finally saving and
+// restoring are timed, alternating between two states a frame apart so
+// every restore has memory to re-decode.
+//
+// usage: chip8_savestate [frames before] [frames after]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "aot_roms.hpp"
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint32_t default_frames_before = 600;
+static constexpr uint32_t default_frames_after = 300;
+static constexpr int timing_rounds = 10'000;
+
+static const std::vector<std::string_view> ROMS = {
+    "test_opcode.ch8", "pong.ch8", "invaders.ch8", "tetris.ch8"};
+static const std::vector<std::pair<dispatch_mode, const char *>> MODES = {
+    {dispatch_mode::reference, "reference"},
+    {dispatch_mode::table, "table"},
+    {dispatch_mode::predecoded, "predecoded"},
+    {dispatch_mode::fused, "fused"},
+#ifdef CHIP8_HAS_JIT
+    {dispatch_mode::jit, "jit"},
+#endif
+    {dispatch_mode::aot, "aot"},
+};
+
+// A VM with its own keypad, the ROM loaded and the mode set
+struct machine {
+  keyboard numpad;
+  chip8 vm{&numpad};
+
+  machine(const std::string_view rom, const dispatch_mode mode) {
+    vm.set_fixed_seed(1);
+    vm.set_dispatch_mode(mode);
+    vm.load_memory(std::string{CHIP8_ROM_DIR} + '/' + std::string{rom});
+    if (mode == dispatch_mode::aot) {
+      vm.attach_aot(find_aot_rom(rom));
+    }
+  }
+  void run(const uint32_t frames) {
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+      // Nobody presses keys here, so a game waiting for one stays put
+      if (vm.run_frame().reason == run_stop::key_wait) {
+        break;
+      }
+    }
+  }
+};
+
+template <typename Fn> static double nanoseconds_per_call(Fn &&fn) {
+  const auto begin = std::chrono::steady_clock::now();
+  for (int round = 0; round < timing_rounds; ++round) {
+    fn(round);
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - begin;
+  return elapsed.count() / timing_rounds;
+}
+
+int main(int argc, char **argv) {
+  const uint32_t before =
+      (argc > 1) ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10))
+                 : default_frames_before;
+  const uint32_t after =
+      (argc > 2) ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10))
+                 : default_frames_after;
+
+  bool ok = true;
+  for (const auto rom : ROMS) {
+    for (const auto &[mode, name] : MODES) {
+      // The VMs are big, and five of them are alive at once
+      auto original = std::make_unique<machine>(rom, mode);
+      original->run(before);
+      auto snapshot = std::make_unique<saved_state>();
+      original->vm.save_state(*snapshot);
+
+      original->run(after);
+      auto expected = std::make_unique<saved_state>();
+      original->vm.save_state(*expected);
+
+      const bool restored = original->vm.load_state(*snapshot);
+      original->run(after);
+      auto rerun = std::make_unique<saved_state>();
+      original->vm.save_state(*rerun);
+
+      // Starts from a different ROM, so load_state() has to replace it all
+      auto fresh = std::make_unique<machine>(
+          (rom == ROMS.front()) ? ROMS.back() : ROMS.front(), mode);
+      const bool moved = fresh->vm.load_state(*snapshot);
+      fresh->run(after);
+      auto elsewhere = std::make_unique<saved_state>();
+      fresh->vm.save_state(*elsewhere);
+
+      const bool same = restored && moved && (*rerun == *expected) &&
+                        (*elsewhere == *expected);
+      ok = ok && same;
+
+      auto next = std::make_unique<saved_state>();
+      original->vm.load_state(*snapshot);
+      original->run(1);
+      original->vm.save_state(*next);
+      const double save_ns = nanoseconds_per_call(
+          [&](int) { original->vm.save_state(*expected); });
+      const double load_ns = nanoseconds_per_call([&](const int round) {
+        static_cast<void>(
+            original->vm.load_state((round & 1) ? *next : *snapshot));
+      });
+      std::printf("%-16s %-10s save %7.0f ns load %7.0f ns %s\n", rom.data(),
+                  name, save_ns, load_ns, same ? "ok" : "FAILED");
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,64 @@
+// Runs a bundled ROM on a VM built with CONFIG_CHIP8_TRACE and writes the
+// instructions it executed to a file for tools/chip8_trace.py. Also
+// reports how fast the VM runs while tracing.
+//
+// usage: chip8_trace <trace file> [rom] [cycles]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "cpu.hpp"
+#include "keyboard.hpp"
+
+static constexpr uint64_t default_cycles = 1'000'000;
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: chip8_trace <trace file> [rom] [cycles]\n");
+    return EXIT_FAILURE;
+  }
+  const std::string rom = (argc > 2) ? argv[2] : "pong.ch8";
+  const uint64_t cycles =
+      (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : default_cycles;
+
+  keyboard numpad;
+  // The trace ring is far too big for the stack
+  auto emulator = std::make_unique<chip8>(&numpad);
+  emulator->set_fixed_seed(1);
+  emulator->load_memory(std::string{CHIP8_ROM_DIR} + '/' + rom);
+
+  const auto begin = std::chrono::steady_clock::now();
+  uint64_t done = 0;
+  while (done < cycles) {
+    const auto batch = emulator->run_cycles(
+        static_cast<uint32_t>(std::min<uint64_t>(cycles - done, 100'000)));
+    done += batch.cycles;
+    // Nobody presses keys here, so a game waiting for one is done
+    if (batch.reason == run_stop::key_wait) {
+      break;
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+
+  std::FILE *out = std::fopen(argv[1], "wb");
+  const bool written = out && emulator->write_trace(out);
+  if (out) {
+    std::fclose(out);
+  }
+  if (!written) {
+    std::fprintf(stderr, "cannot write %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  std::printf("%s: %llu instructions traced at %.0f instr/s, the last %u "
+              "written to %s\n",
+              rom.c_str(), static_cast<unsigned long long>(done),
+              static_cast<double>(done) / elapsed.count(),
+              static_cast<unsigned>(
+                  std::min<uint64_t>(done, CONFIG_CHIP8_TRACE_RECORDS)),
+              argv[1]);
+  return EXIT_SUCCESS;
+}
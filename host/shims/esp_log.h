@@ -0,0 +1,21 @@
+// Host stand-in for the ESP-IDF logger. Debug and verbose logs are
+// compiled out like they are with the default sdkconfig log level.
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  fprintf(stderr, "E (%s): " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                             \
+  fprintf(stderr, "W (%s): " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                             \
+  fprintf(stderr, "I (%s): " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                             \
+  do {                                                                         \
+  } while (0)
+#define ESP_LOGV(tag, format, ...)                                             \
+  do {                                                                         \
+  } while (0)
+
+#endif // HOST_ESP_LOG_H_
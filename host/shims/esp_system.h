@@ -0,0 +1,17 @@
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include <stdint.h>
+#include <sys/random.h>
+
+#include "esp_err.h"
+
+// The ESP32 hardware random number generator
+static inline uint32_t esp_random(void) {
+  uint32_t value = 0;
+  while (getrandom(&value, sizeof(value), 0) != (ssize_t)sizeof(value)) {
+  }
+  return value;
+}
+
+#endif // HOST_ESP_SYSTEM_H_
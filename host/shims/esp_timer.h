@@ -0,0 +1,14 @@
+// Host stand-in for the ESP-IDF high resolution timer
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((int64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+#endif // HOST_ESP_TIMER_H_
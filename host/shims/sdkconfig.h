@@ -0,0 +1,10 @@
+#ifndef HOST_SDKCONFIG_H_
+#define HOST_SDKCONFIG_H_
+
+// Defaults of the options in components/*/Kconfig that the VM uses
+#define CONFIG_CHIP8_CYCLES_PER_FRAME 12
+// CONFIG_CHIP8_PROFILER, CONFIG_CHIP8_TRACE and CONFIG_CHIP8_REWIND are
+// off by default; host/CMakeLists.txt defines them for the
+// chip8_vm_profiled, chip8_vm_traced and chip8_vm_rewind libraries only
+
+#endif // HOST_SDKCONFIG_H_
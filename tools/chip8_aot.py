@@ -0,0 +1,324 @@
+#!/usr/bin/env python3
+"""Ahead-of-time translator from CHIP-8 ROMs to C++.
+
+Every basic block reachable from the entry point of a ROM becomes a C++
+function operating on the VM through aot_runtime (components/VM/aot.hpp).
+Simple register operations are emitted inline; anything touching the
+display, the keypad, the stack, memory or the random generator goes back
+through the interpreter handlers. The VM falls back to the interpreter for
+addresses without a block (BNNN targets, code only reachable that way) and
+for blocks the guest has written over.
+
+usage: chip8_aot.py -o aot_roms.cpp rom.ch8 [rom.ch8 ...]
+"""
+
+import argparse
+import os
+import re
+import sys
+
+PROG_MEM_BEGIN = 0x200
+MEMORY_SIZE = 4096
+MAX_BLOCK_LENGTH = 64
+
+
+def fields(op):
+    return {
+        'x': (op >> 8) & 0xF,
+        'y': (op >> 4) & 0xF,
+        'n': op & 0xF,
+        'nn': op & 0xFF,
+        'nnn': op & 0xFFF,
+    }
+
+
+def classify(op):
+    """Same classification as classify() in components/VM/decoder.hpp."""
+    top = op & 0xF000
+    if top == 0x0000:
+        return {0xEE: '00EE', 0xE0: '00E0'}.get(op & 0xFF, 'unknown')
+    if top == 0x8000:
+        names = {0x0: '8XY0', 0x1: '8XY1', 0x2: '8XY2', 0x3: '8XY3',
+                 0x4: '8XY4', 0x5: '8XY5', 0x6: '8XY6', 0x7: '8XY7',
+                 0xE: '8XYE'}
+        return names.get(op & 0xF, 'unknown')
+    if top == 0xE000:
+        return {0x9E: 'EX9E', 0xA1: 'EXA1'}.get(op & 0xFF, 'unknown')
+    if top == 0xF000:
+        names = {0x07: 'FX07', 0x0A: 'FX0A', 0x15: 'FX15', 0x18: 'FX18',
+                 0x1E: 'FX1E', 0x29: 'FX29', 0x33: 'FX33', 0x55: 'FX55',
+                 0x65: 'FX65'}
+        return names.get(op & 0xFF, 'unknown')
+    return {0x1000: '1NNN', 0x2000: '2NNN', 0x3000: '3XNN', 0x4000: '4XNN',
+            0x5000: '5XY0', 0x6000: '6XNN', 0x7000: '7XNN', 0x9000: '9XY0',
+            0xA000: 'ANNN', 0xB000: 'BNNN', 0xC000: 'CXNN',
+            0xD000: 'DXYN'}[top]
+
+
+# Conditional skips: condition under which the next instruction is skipped
+SKIPS = {
+    '3XNN': 'V[{x}] == {nn:#04x}',
+    '4XNN': 'V[{x}] != {nn:#04x}',
+    '5XY0': 'V[{x}] == V[{y}]',
+    '9XY0': 'V[{x}] != V[{y}]',
+}
+
+# Straight-line operations, written exactly like the interpreter handlers
+INLINE = {
+    '6XNN': ['V[{x}] = {nn:#04x};'],
+    '7XNN': ['V[{x}] = static_cast<uint8_t>(V[{x}] + {nn:#04x});'],
+    '8XY0': ['V[{x}] = V[{y}];'],
+    '8XY1': ['V[{x}] = V[{x}] | V[{y}];'],
+    '8XY2': ['V[{x}] = V[{x}] & V[{y}];'],
+    '8XY3': ['V[{x}] = V[{x}] ^ V[{y}];'],
+    '8XY4': ['{{',
+             '  const auto sum = static_cast<uint16_t>(V[{y}] + V[{x}]);',
+             '  V[0xF] = static_cast<uint8_t>((sum & 0x100) >> 8);',
+             '  V[{x}] = static_cast<uint8_t>(sum);',
+             '}}'],
+    '8XY5': ['V[0xF] = (V[{x}] > V[{y}]) ? 1 : 0;',
+             'V[{x}] = static_cast<uint8_t>(V[{x}] - V[{y}]);'],
+    '8XY6': ['V[0xF] = V[{y}] & 0x01;',
+             'V[{y}] = static_cast<uint8_t>(V[{y}] >> 1);',
+             'V[{x}] = V[{y}];'],
+    '8XY7': ['V[0xF] = (V[{y}] > V[{x}]) ? 1 : 0;',
+             'V[{x}] = static_cast<uint8_t>(V[{y}] - V[{x}]);'],
+    '8XYE': ['V[0xF] = static_cast<uint8_t>((V[{y}] & 0x80) >> 7);',
+             'V[{y}] = static_cast<uint8_t>(V[{y}] << 1);',
+             'V[{x}] = V[{y}];'],
+    'ANNN': ['I = {nnn:#05x};'],
+    'FX07': ['V[{x}] = rt::delay_timer(vm);'],
+    'FX15': ['rt::delay_timer(vm) = V[{x}];'],
+    'FX18': ['rt::sound_timer(vm) = V[{x}];'],
+    'FX1E': ['I = static_cast<uint16_t>(I + V[{x}]);'],
+    'FX29': ['I = static_cast<uint16_t>(5 * V[{x}]);'],
+}
+
+TIMER_OPS = {'FX07', 'FX15', 'FX18'}
+# Leave the block after these and let the dispatcher pick the next one.
+# FX33/FX55 may have rewritten code that follows them.
+ENDS_BLOCK = {'1NNN', '2NNN', '00EE', 'BNNN', 'EX9E', 'EXA1', 'FX0A',
+              'FX33', 'FX55'} | set(SKIPS)
+
+
+class Rom:
+    def __init__(self, path):
+        self.path = path
+        self.name = os.path.basename(path)
+        with open(path, 'rb') as f:
+            self.image = f.read()
+        if PROG_MEM_BEGIN + len(self.image) > MEMORY_SIZE:
+            sys.exit('{}: ROM does not fit into memory'.format(path))
+        self.end = PROG_MEM_BEGIN + len(self.image)
+
+    def has_instruction(self, pc):
+        return PROG_MEM_BEGIN <= pc and pc + 2 <= self.end
+
+    def opcode(self, pc):
+        offset = pc - PROG_MEM_BEGIN
+        return (self.image[offset] << 8) | self.image[offset + 1]
+
+
+def successors(pc, op, kind):
+    f = fields(op)
+    nxt = (pc + 2) & 0x0FFF
+    if kind == '1NNN':
+        return [f['nnn']]
+    if kind == '2NNN':
+        return [f['nnn'], nxt]
+    if kind in ('00EE', 'BNNN'):
+        return []
+    if kind in SKIPS:
+        return [nxt, (nxt + 2) & 0x0FFF]
+    if kind in ('EX9E', 'EXA1'):
+        return [nxt, (nxt + 2) & 0x0FFF]
+    return [nxt]
+
+
+def find_leaders(rom):
+    """Block start addresses reachable from the entry point."""
+    leaders = {PROG_MEM_BEGIN}
+    seen = set()
+    work = [PROG_MEM_BEGIN]
+    while work:
+        pc = work.pop()
+        if pc in seen or not rom.has_instruction(pc):
+            continue
+        seen.add(pc)
+        op = rom.opcode(pc)
+        kind = classify(op)
+        succ = successors(pc, op, kind)
+        if kind in ENDS_BLOCK:
+            leaders.update(succ)
+        work.extend(succ)
+    return sorted(pc for pc in leaders if rom.has_instruction(pc))
+
+
+def translate_block(rom, start, leaders, index):
+    """Returns (end, length, lines) for the block starting at start.
+
+    index maps block start addresses to their position in the block table.
+    """
+    lines = []
+    pending_ticks = 0
+    pc = start
+    length = 0
+
+    def flush_ticks():
+        nonlocal pending_ticks
+        if pending_ticks:
+            lines.append('rt::ticks(vm, {});'.format(pending_ticks))
+            pending_ticks = 0
+
+    def successor(target):
+        if target in index:
+            return '{}; // block_{:03x}'.format(index[target], target)
+        return 'aot_dynamic_exit;'
+
+    def exit_to(target, indent=''):
+        lines.append(indent + 'rt::jump(vm, {:#05x});'.format(target))
+        lines.append(indent + 'return ' + successor(target))
+
+    while True:
+        op = rom.opcode(pc)
+        kind = classify(op)
+        f = fields(op)
+        nxt = (pc + 2) & 0x0FFF
+        length += 1
+        pending_ticks += 1
+        lines.append('// {:03x}: {:04x} {}'.format(pc, op, kind))
+        if kind in TIMER_OPS:
+            flush_ticks()
+        if kind in INLINE:
+            lines.extend(s.format(**f) for s in INLINE[kind])
+        elif kind == '1NNN':
+            flush_ticks()
+            exit_to(f['nnn'])
+            break
+        elif kind in SKIPS:
+            flush_ticks()
+            lines.append('if ({}) {{'.format(SKIPS[kind].format(**f)))
+            exit_to((nxt + 2) & 0x0FFF, '  ')
+            lines.append('}')
+            exit_to(nxt)
+            break
+        else:
+            # 00E0, 00EE, 2NNN, BNNN, CXNN, DXYN, EX9E, EXA1, FX0A, FX33,
+            # FX55, FX65 and unknown opcodes run through the interpreter.
+            # None of them looks at the timers, so ticks can wait.
+            if kind in ENDS_BLOCK:
+                flush_ticks()
+            lines.append('rt::exec(vm, {:#06x}, {:#05x});'.format(op, nxt))
+            if kind == '2NNN':
+                lines.append('return ' + successor(f['nnn']))
+            elif kind in ('FX33', 'FX55'):
+                lines.append('return ' + successor(nxt))
+            elif kind in ('EX9E', 'EXA1', 'FX0A'):
+                # Either falls through or skips (EX9E/EXA1) or retries
+                # itself (FX0A)
+                other = (nxt + 2) & 0x0FFF if kind != 'FX0A' else pc
+                lines.append('if (rt::pc(vm) == {:#05x}) {{'.format(other))
+                lines.append('  return ' + successor(other))
+                lines.append('}')
+                lines.append('return ' + successor(nxt))
+            elif kind in ENDS_BLOCK:
+                lines.append('return aot_dynamic_exit;')
+            if kind in ENDS_BLOCK:
+                break
+        pc = nxt
+        if (pc in leaders or length == MAX_BLOCK_LENGTH or
+                not rom.has_instruction(pc)):
+            flush_ticks()
+            exit_to(pc)
+            break
+    return start + 2 * length, length, lines
+
+
+def identifier(name):
+    ident = re.sub(r'\W', '_', os.path.splitext(name)[0])
+    return ident if not ident[0].isdigit() else '_' + ident
+
+
+def uses(lines, token):
+    return any(token in line for line in lines if not line.startswith('//'))
+
+
+def emit_rom(out, rom):
+    leaders = find_leaders(rom)
+    leader_set = set(leaders)
+    index = {start: i for i, start in enumerate(leaders)}
+    ns = 'aot_' + identifier(rom.name)
+    out.append('namespace {} {{'.format(ns))
+    out.append('')
+    out.append('const uint8_t image[] = {')
+    for i in range(0, len(rom.image), 12):
+        chunk = rom.image[i:i + 12]
+        out.append('    ' + ' '.join('{:#04x},'.format(b) for b in chunk))
+    out.append('};')
+    out.append('')
+
+    table = []
+    for start in leaders:
+        end, length, lines = translate_block(rom, start, leader_set, index)
+        fn = 'block_{:03x}'.format(start)
+        out.append('uint16_t {}(chip8 &vm) {{'.format(fn))
+        if uses(lines, 'V['):
+            out.append('  auto &V = rt::V(vm);')
+        if uses(lines, 'I = '):
+            out.append('  auto &I = rt::I(vm);')
+        out.extend('  ' + line for line in lines)
+        out.append('}')
+        out.append('')
+        table.append('    {{{:#05x}, {:#05x}, {}, {}}},'.format(
+            start, end, length, fn))
+
+    out.append('const aot_block blocks[] = {')
+    out.extend(table)
+    out.append('};')
+    out.append('')
+    out.append('const aot_rom rom = {{"{}", image, sizeof(image), blocks,'
+               .format(rom.name))
+    out.append('                     sizeof(blocks) / sizeof(blocks[0])};')
+    out.append('')
+    out.append('}} // namespace {}'.format(ns))
+    out.append('')
+    return ns
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('-o', '--output', required=True)
+    parser.add_argument('roms', nargs='+')
+    args = parser.parse_args()
+
+    roms = sorted((Rom(path) for path in args.roms), key=lambda r: r.name)
+    out = [
+        '// Generated by tools/chip8_aot.py, do not edit.',
+        '#include <cstdint>',
+        '#include <string_view>',
+        '',
+        '#include "aot.hpp"',
+        '#include "aot_roms.hpp"',
+        '',
+        'using rt = aot_runtime;',
+        '',
+        'namespace {',
+        '',
+    ]
+    namespaces = [(rom.name, emit_rom(out, rom)) for rom in roms]
+    out.append('} // namespace')
+    out.append('')
+    out.append('const aot_rom *find_aot_rom(std::string_view name) {')
+    for name, ns in namespaces:
+        out.append('  if (name == "{}") {{'.format(name))
+        out.append('    return &{}::rom;'.format(ns))
+        out.append('  }')
+    out.append('  return nullptr;')
+    out.append('}')
+
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Prints a binary CHIP-8 instruction trace as a disassembly.
+
+The trace comes from a VM built with CONFIG_CHIP8_TRACE, either written to
+trace.bin on SPIFFS by the firmware or by host/chip8_trace. The format is
+described in components/VM/trace.hpp. Every line shows the cycle, the
+address, the opcode, its disassembly and the registers it wrote.
+
+usage: chip8_trace.py [--last N] trace.bin
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b'C8TR'
+VERSION = 1
+HEADER = struct.Struct('<4sHHII')
+RECORD = struct.Struct('<IHHHBB')
+
+
+def disassemble(op):
+    x = (op >> 8) & 0xF
+    y = (op >> 4) & 0xF
+    n = op & 0xF
+    nn = op & 0xFF
+    nnn = op & 0xFFF
+    top = op >> 12
+    if op == 0x00E0:
+        return 'CLS'
+    if op == 0x00EE:
+        return 'RET'
+    if top == 0x1:
+        return f'JP   {nnn:#05x}'
+    if top == 0x2:
+        return f'CALL {nnn:#05x}'
+    if top == 0x3:
+        return f'SE   V{x:X}, {nn:#04x}'
+    if top == 0x4:
+        return f'SNE  V{x:X}, {nn:#04x}'
+    if top == 0x5:
+        return f'SE   V{x:X}, V{y:X}'
+    if top == 0x6:
+        return f'LD   V{x:X}, {nn:#04x}'
+    if top == 0x7:
+        return f'ADD  V{x:X}, {nn:#04x}'
+    if top == 0x8:
+        names = {0x0: 'LD', 0x1: 'OR', 0x2: 'AND', 0x3: 'XOR', 0x4: 'ADD',
+                 0x5: 'SUB', 0x6: 'SHR', 0x7: 'SUBN', 0xE: 'SHL'}
+        if n in names:
+            return f'{names[n]:<4} V{x:X}, V{y:X}'
+    if top == 0x9:
+        return f'SNE  V{x:X}, V{y:X}'
+    if top == 0xA:
+        return f'LD   I, {nnn:#05x}'
+    if top == 0xB:
+        return f'JP   V0, {nnn:#05x}'
+    if top == 0xC:
+        return f'RND  V{x:X}, {nn:#04x}'
+    if top == 0xD:
+        return f'DRW  V{x:X}, V{y:X}, {n}'
+    if top == 0xE and nn == 0x9E:
+        return f'SKP  V{x:X}'
+    if top == 0xE and nn == 0xA1:
+        return f'SKNP V{x:X}'
+    if top == 0xF:
+        forms = {0x07: 'LD   V{x:X}, DT', 0x0A: 'LD   V{x:X}, K',
+                 0x15: 'LD   DT, V{x:X}', 0x18: 'LD   ST, V{x:X}',
+                 0x1E: 'ADD  I, V{x:X}', 0x29: 'LD   F, V{x:X}',
+                 0x33: 'LD   B, V{x:X}', 0x55: 'LD   [I], V{x:X}',
+                 0x65: 'LD   V{x:X}, [I]'}
+        if nn in forms:
+            return forms[nn].format(x=x)
+    return f'DW   {op:#06x}'
+
+
+def effects(op, i, vx, vf):
+    """The registers the instruction wrote, as far as the record has them."""
+    x = (op >> 8) & 0xF
+    top = op >> 12
+    nn = op & 0xFF
+    writes_vx = (top in (0x6, 0x7, 0xC) or
+                 (top == 0x8 and (op & 0xF) in (0, 1, 2, 3, 4, 5, 6, 7, 0xE)) or
+                 (top == 0xF and nn in (0x07, 0x0A, 0x65)))
+    writes_vf = ((top == 0x8 and (op & 0xF) in (4, 5, 6, 7, 0xE)) or
+                 top == 0xD)
+    writes_i = (top == 0xA or (top == 0xF and nn in (0x1E, 0x29, 0x55, 0x65)))
+    out = []
+    if writes_vx and not (writes_vf and x == 0xF):
+        out.append(f'V{x:X}={vx:02x}')
+    if writes_vf:
+        out.append(f'VF={vf:02x}')
+    if writes_i:
+        out.append(f'I={i:03x}')
+    return ' '.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--last', type=int, default=0,
+                        help='only print the last N instructions')
+    parser.add_argument('trace')
+    args = parser.parse_args()
+
+    with open(args.trace, 'rb') as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit(f'{args.trace}: too short for a trace')
+    magic, version, size, count, total = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or size != RECORD.size:
+        sys.exit(f'{args.trace}: not a version {VERSION} CHIP-8 trace')
+    count = min(count, (len(data) - HEADER.size) // RECORD.size)
+
+    first = max(0, count - args.last) if args.last > 0 else 0
+    print(f'# {count} of {total} executed instructions')
+    for index in range(first, count):
+        cycle, pc, op, i, vx, vf = RECORD.unpack_from(
+            data, HEADER.size + index * RECORD.size)
+        line = f'{cycle:>10} {pc:03x}  {op:04x}  {disassemble(op):<18}'
+        print(f'{line} {effects(op, i, vx, vf)}'.rstrip())
+
+
+if __name__ == '__main__':
+    main()